@@ -0,0 +1,629 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+#include "spotifyAudioCache.h"
+#include "AdvancedSettings.h"
+#include "FileSystem/Directory.h"
+#include "Util.h"
+#include "utils/SingleLock.h"
+#include "utils/log.h"
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+
+using namespace std;
+using namespace XFILE;
+
+#define SPOTIFY_CACHE_VERSION 1
+#define SPOTIFY_CACHE_FRAMES_PER_BLOCK 4096
+#define SPOTIFY_CACHE_FOOTER_SIZE 40
+//residuals that would need a longer unary code than this are stored raw
+#define SPOTIFY_CACHE_ESCAPE 24
+#define SPOTIFY_CACHE_RAW_BITS 17
+
+map<CStdString, SpotifyAudioCache::Entry> SpotifyAudioCache::m_entries;
+int64_t SpotifyAudioCache::m_totalSize = 0;
+bool SpotifyAudioCache::m_isLoaded = false;
+CCriticalSection SpotifyAudioCache::m_lock;
+
+//little endian helpers, the files should be readable on any platform
+static void putU32(vector<unsigned char> &out, uint32_t value)
+{
+  for (int i = 0; i < 4; i++)
+    out.push_back((value >> (8 * i)) & 0xff);
+}
+
+static void putU64(vector<unsigned char> &out, uint64_t value)
+{
+  for (int i = 0; i < 8; i++)
+    out.push_back((value >> (8 * i)) & 0xff);
+}
+
+static uint32_t getU32(const unsigned char *in)
+{
+  return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+static uint64_t getU64(const unsigned char *in)
+{
+  return getU32(in) | ((uint64_t)getU32(in + 4) << 32);
+}
+
+class SpotifyBitWriter
+{
+public:
+  SpotifyBitWriter(vector<unsigned char> &out) : m_out(out), m_acc(0), m_bits(0) {}
+
+  //count can be at most 24
+  void put(uint32_t value, int count)
+  {
+    m_acc = (m_acc << count) | (value & ((1u << count) - 1));
+    m_bits += count;
+    while (m_bits >= 8)
+    {
+      m_bits -= 8;
+      m_out.push_back((m_acc >> m_bits) & 0xff);
+    }
+    m_acc &= (1u << m_bits) - 1;
+  }
+
+  void putRice(uint32_t value, int k)
+  {
+    uint32_t q = value >> k;
+    if (q >= SPOTIFY_CACHE_ESCAPE)
+    {
+      put((1u << SPOTIFY_CACHE_ESCAPE) - 1, SPOTIFY_CACHE_ESCAPE);
+      put(value, SPOTIFY_CACHE_RAW_BITS);
+      return;
+    }
+    put(((1u << q) - 1) << 1, q + 1);
+    if (k > 0)
+      put(value, k);
+  }
+
+  void flush()
+  {
+    if (m_bits > 0)
+      m_out.push_back((m_acc << (8 - m_bits)) & 0xff);
+    m_acc = 0;
+    m_bits = 0;
+  }
+
+private:
+  vector<unsigned char> &m_out;
+  uint32_t m_acc;
+  int m_bits;
+};
+
+class SpotifyBitReader
+{
+public:
+  SpotifyBitReader(const unsigned char *in, unsigned int size) : m_in(in), m_size(size), m_pos(0), m_acc(0), m_bits(0) {}
+
+  uint32_t get(int count)
+  {
+    while (m_bits < count)
+    {
+      m_acc = (m_acc << 8) | (m_pos < m_size ? m_in[m_pos] : 0);
+      m_pos++;
+      m_bits += 8;
+    }
+    m_bits -= count;
+    return (m_acc >> m_bits) & ((1u << count) - 1);
+  }
+
+  uint32_t getRice(int k)
+  {
+    uint32_t q = 0;
+    while (q < SPOTIFY_CACHE_ESCAPE && get(1))
+      q++;
+    if (q == SPOTIFY_CACHE_ESCAPE)
+      return get(SPOTIFY_CACHE_RAW_BITS);
+    return k > 0 ? (q << k) | get(k) : q;
+  }
+
+  //continue at the next whole byte
+  void align()
+  {
+    m_bits = 0;
+    m_acc = 0;
+  }
+
+  unsigned int position(){ return m_pos; }
+  void seek(unsigned int pos){ m_pos = pos; align(); }
+
+private:
+  const unsigned char *m_in;
+  unsigned int m_size;
+  unsigned int m_pos;
+  uint32_t m_acc;
+  int m_bits;
+};
+
+//the cache index
+bool SpotifyAudioCache::IsEnabled()
+{
+  return g_advancedSettings.m_spotifyAudioCacheSize > 0;
+}
+
+CStdString SpotifyAudioCache::GetFolder()
+{
+  return CUtil::AddFileToFolder(g_advancedSettings.m_spotifyCacheFolder, "audio/");
+}
+
+CStdString SpotifyAudioCache::getKey(const CStdString &uri)
+{
+  //spotify:track:<id>, the id is all we need
+  int pos = uri.ReverseFind(':');
+  return pos >= 0 ? uri.Mid(pos + 1) : uri;
+}
+
+CStdString SpotifyAudioCache::GetFileName(const CStdString &uri)
+{
+  return CUtil::AddFileToFolder(GetFolder(), getKey(uri) + ".spx");
+}
+
+void SpotifyAudioCache::load()
+{
+  if (m_isLoaded)
+    return;
+  m_isLoaded = true;
+  m_entries.clear();
+  m_totalSize = 0;
+  CDirectory::Create(GetFolder());
+
+  CFile file;
+  if (!file.Open(CUtil::AddFileToFolder(GetFolder(), "index")))
+    return;
+
+  char line[256];
+  while (file.ReadString(line, sizeof(line)))
+  {
+    char key[128];
+    long long size;
+    unsigned int lastUsed;
+    if (sscanf(line, "%127s %lld %u", key, &size, &lastUsed) == 3)
+    {
+      Entry entry;
+      entry.size = size;
+      entry.lastUsed = lastUsed;
+      m_entries[key] = entry;
+      m_totalSize += size;
+    }
+  }
+  file.Close();
+}
+
+void SpotifyAudioCache::save()
+{
+  CFile file;
+  if (!file.OpenForWrite(CUtil::AddFileToFolder(GetFolder(), "index"), true))
+  {
+    CLog::Log(LOGERROR, "Spotifylog: could not write the audio cache index");
+    return;
+  }
+
+  for (map<CStdString, Entry>::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+  {
+    CStdString line;
+    line.Format("%s %lld %u\n", it->first.c_str(), (long long)it->second.size, it->second.lastUsed);
+    file.Write(line.c_str(), line.size());
+  }
+  file.Close();
+}
+
+void SpotifyAudioCache::evict()
+{
+  int64_t maxSize = (int64_t)g_advancedSettings.m_spotifyAudioCacheSize * 1024 * 1024;
+  while (m_totalSize > maxSize && !m_entries.empty())
+  {
+    map<CStdString, Entry>::iterator oldest = m_entries.begin();
+    for (map<CStdString, Entry>::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+    {
+      if (it->second.lastUsed < oldest->second.lastUsed)
+        oldest = it;
+    }
+    CLog::Log(LOGDEBUG, "Spotifylog: audio cache evicting %s", oldest->first.c_str());
+    CFile::Delete(CUtil::AddFileToFolder(GetFolder(), oldest->first + ".spx"));
+    m_totalSize -= oldest->second.size;
+    m_entries.erase(oldest);
+  }
+}
+
+bool SpotifyAudioCache::Has(const CStdString &uri)
+{
+  if (!IsEnabled())
+    return false;
+
+  CSingleLock lock(m_lock);
+  load();
+  return m_entries.find(getKey(uri)) != m_entries.end() && CFile::Exists(GetFileName(uri));
+}
+
+void SpotifyAudioCache::Touch(const CStdString &uri)
+{
+  CSingleLock lock(m_lock);
+  load();
+  map<CStdString, Entry>::iterator it = m_entries.find(getKey(uri));
+  if (it != m_entries.end())
+  {
+    it->second.lastUsed = time(NULL);
+    save();
+  }
+}
+
+void SpotifyAudioCache::Add(const CStdString &uri, int64_t size)
+{
+  CSingleLock lock(m_lock);
+  load();
+  CStdString key = getKey(uri);
+  map<CStdString, Entry>::iterator it = m_entries.find(key);
+  if (it != m_entries.end())
+    m_totalSize -= it->second.size;
+
+  Entry entry;
+  entry.size = size;
+  entry.lastUsed = time(NULL);
+  m_entries[key] = entry;
+  m_totalSize += size;
+  evict();
+  save();
+}
+
+void SpotifyAudioCache::Remove(const CStdString &uri)
+{
+  CSingleLock lock(m_lock);
+  load();
+  map<CStdString, Entry>::iterator it = m_entries.find(getKey(uri));
+  if (it != m_entries.end())
+  {
+    m_totalSize -= it->second.size;
+    m_entries.erase(it);
+    save();
+  }
+  CFile::Delete(GetFileName(uri));
+}
+
+//writer
+SpotifyAudioCacheWriter::SpotifyAudioCacheWriter()
+{
+  m_isOpen = false;
+  m_sampleRate = 0;
+  m_channels = 0;
+  m_filePos = 0;
+  m_totalBytes = 0;
+}
+
+SpotifyAudioCacheWriter::~SpotifyAudioCacheWriter()
+{
+  Abort();
+}
+
+bool SpotifyAudioCacheWriter::Open(const CStdString &uri, int sampleRate, int channels)
+{
+  Abort();
+  if (!SpotifyAudioCache::IsEnabled() || channels <= 0)
+    return false;
+
+  m_uri = uri;
+  m_tempFile = SpotifyAudioCache::GetFileName(uri) + ".tmp";
+  CDirectory::Create(SpotifyAudioCache::GetFolder());
+  if (!m_file.OpenForWrite(m_tempFile, true))
+  {
+    CLog::Log(LOGERROR, "Spotifylog: could not create audio cache file %s", m_tempFile.c_str());
+    return false;
+  }
+
+  m_sampleRate = sampleRate;
+  m_channels = channels;
+  m_pending.clear();
+  m_index.clear();
+  m_filePos = 0;
+  m_totalBytes = 0;
+  m_isOpen = true;
+  return true;
+}
+
+void SpotifyAudioCacheWriter::Write(const char *data, int size)
+{
+  if (!m_isOpen || size <= 0)
+    return;
+
+  m_pending.insert(m_pending.end(), data, data + size);
+  m_totalBytes += size;
+
+  unsigned int blockBytes = SPOTIFY_CACHE_FRAMES_PER_BLOCK * m_channels * sizeof(int16_t);
+  while (m_isOpen && m_pending.size() >= blockBytes)
+    encodeBlock();
+}
+
+bool SpotifyAudioCacheWriter::encodeBlock()
+{
+  unsigned int frameSize = m_channels * sizeof(int16_t);
+  unsigned int frames = m_pending.size() / frameSize;
+  if (frames > SPOTIFY_CACHE_FRAMES_PER_BLOCK)
+    frames = SPOTIFY_CACHE_FRAMES_PER_BLOCK;
+  if (frames == 0)
+    return true;
+
+  const int16_t *samples = (const int16_t*)&m_pending[0];
+  m_encoded.clear();
+  putU32(m_encoded, frames);
+
+  for (int channel = 0; channel < m_channels; channel++)
+  {
+    //find the best rice parameter from the mean delta
+    uint64_t sum = 0;
+    for (unsigned int i = 1; i < frames; i++)
+    {
+      int delta = samples[i * m_channels + channel] - samples[(i - 1) * m_channels + channel];
+      sum += delta >= 0 ? 2 * delta : -2 * delta - 1;
+    }
+    int k = 0;
+    while (k < 16 && ((uint64_t)(frames - 1) << (k + 1)) <= sum)
+      k++;
+
+    m_encoded.push_back(k);
+    uint16_t first = samples[channel];
+    m_encoded.push_back(first & 0xff);
+    m_encoded.push_back(first >> 8);
+
+    SpotifyBitWriter writer(m_encoded);
+    for (unsigned int i = 1; i < frames; i++)
+    {
+      int delta = samples[i * m_channels + channel] - samples[(i - 1) * m_channels + channel];
+      writer.putRice(delta >= 0 ? 2 * delta : -2 * delta - 1, k);
+    }
+    writer.flush();
+  }
+
+  m_index.push_back(m_filePos);
+  if (m_file.Write(&m_encoded[0], m_encoded.size()) != (int)m_encoded.size())
+  {
+    CLog::Log(LOGERROR, "Spotifylog: error writing audio cache file %s", m_tempFile.c_str());
+    Abort();
+    return false;
+  }
+  m_filePos += m_encoded.size();
+  m_pending.erase(m_pending.begin(), m_pending.begin() + frames * frameSize);
+  return true;
+}
+
+bool SpotifyAudioCacheWriter::Finish()
+{
+  if (!m_isOpen)
+    return false;
+
+  //the last block is shorter, a trailing half frame can not be stored
+  unsigned int frameSize = m_channels * sizeof(int16_t);
+  m_totalBytes -= m_pending.size() % frameSize;
+  if (!encodeBlock())
+    return false;
+
+  m_encoded.clear();
+  for (unsigned int i = 0; i < m_index.size(); i++)
+    putU64(m_encoded, m_index[i]);
+  m_encoded.push_back('S');
+  m_encoded.push_back('P');
+  m_encoded.push_back('X');
+  m_encoded.push_back('C');
+  putU32(m_encoded, SPOTIFY_CACHE_VERSION);
+  putU32(m_encoded, m_sampleRate);
+  putU32(m_encoded, m_channels);
+  putU32(m_encoded, SPOTIFY_CACHE_FRAMES_PER_BLOCK);
+  putU32(m_encoded, m_index.size());
+  putU64(m_encoded, m_totalBytes);
+  putU64(m_encoded, m_filePos);
+
+  bool ok = m_file.Write(&m_encoded[0], m_encoded.size()) == (int)m_encoded.size();
+  m_file.Close();
+  m_isOpen = false;
+
+  CStdString fileName = SpotifyAudioCache::GetFileName(m_uri);
+  CFile::Delete(fileName);
+  if (!ok || !CFile::Rename(m_tempFile, fileName))
+  {
+    CLog::Log(LOGERROR, "Spotifylog: could not finish audio cache file %s", fileName.c_str());
+    CFile::Delete(m_tempFile);
+    return false;
+  }
+
+  CLog::Log(LOGDEBUG, "Spotifylog: cached %s, %lld bytes of pcm in %lld bytes", m_uri.c_str(), (long long)m_totalBytes, (long long)(m_filePos + m_encoded.size()));
+  SpotifyAudioCache::Add(m_uri, m_filePos + m_encoded.size());
+  return true;
+}
+
+void SpotifyAudioCacheWriter::Abort()
+{
+  if (!m_isOpen)
+    return;
+  m_file.Close();
+  CFile::Delete(m_tempFile);
+  m_pending.clear();
+  m_index.clear();
+  m_isOpen = false;
+}
+
+//reader
+SpotifyAudioCacheReader::SpotifyAudioCacheReader()
+{
+  m_isOpen = false;
+  m_sampleRate = 0;
+  m_channels = 0;
+  m_framesPerBlock = 0;
+  m_totalBytes = 0;
+  m_indexOffset = 0;
+  m_currentBlock = 0;
+  m_decodedPos = 0;
+}
+
+SpotifyAudioCacheReader::~SpotifyAudioCacheReader()
+{
+  Close();
+}
+
+bool SpotifyAudioCacheReader::Open(const CStdString &uri)
+{
+  Close();
+  CStdString fileName = SpotifyAudioCache::GetFileName(uri);
+  if (!m_file.Open(fileName))
+    return false;
+
+  int64_t length = m_file.GetLength();
+  unsigned char footer[SPOTIFY_CACHE_FOOTER_SIZE];
+  if (length < SPOTIFY_CACHE_FOOTER_SIZE || m_file.Seek(length - SPOTIFY_CACHE_FOOTER_SIZE) < 0 ||
+      m_file.Read(footer, SPOTIFY_CACHE_FOOTER_SIZE) != SPOTIFY_CACHE_FOOTER_SIZE ||
+      memcmp(footer, "SPXC", 4) != 0 || getU32(footer + 4) != SPOTIFY_CACHE_VERSION)
+  {
+    CLog::Log(LOGERROR, "Spotifylog: broken audio cache file %s", fileName.c_str());
+    m_file.Close();
+    SpotifyAudioCache::Remove(uri);
+    return false;
+  }
+
+  m_sampleRate = getU32(footer + 8);
+  m_channels = getU32(footer + 12);
+  m_framesPerBlock = getU32(footer + 16);
+  unsigned int blocks = getU32(footer + 20);
+  m_totalBytes = getU64(footer + 24);
+  m_indexOffset = getU64(footer + 32);
+
+  vector<unsigned char> index(blocks * 8);
+  if (m_channels <= 0 || m_file.Seek(m_indexOffset) < 0 || (blocks > 0 && m_file.Read(&index[0], index.size()) != index.size()))
+  {
+    CLog::Log(LOGERROR, "Spotifylog: broken audio cache index %s", fileName.c_str());
+    m_file.Close();
+    SpotifyAudioCache::Remove(uri);
+    return false;
+  }
+
+  m_index.resize(blocks);
+  for (unsigned int i = 0; i < blocks; i++)
+    m_index[i] = getU64(&index[i * 8]);
+
+  m_isOpen = true;
+  m_decoded.clear();
+  m_decodedPos = 0;
+  m_currentBlock = 0;
+  if (blocks > 0 && !decodeBlock(0))
+  {
+    Close();
+    return false;
+  }
+  SpotifyAudioCache::Touch(uri);
+  return true;
+}
+
+void SpotifyAudioCacheReader::Close()
+{
+  if (m_isOpen)
+    m_file.Close();
+  m_isOpen = false;
+  m_index.clear();
+  m_decoded.clear();
+}
+
+bool SpotifyAudioCacheReader::decodeBlock(unsigned int block)
+{
+  if (block >= m_index.size())
+    return false;
+
+  uint64_t end = block + 1 < m_index.size() ? m_index[block + 1] : m_indexOffset;
+  unsigned int size = end - m_index[block];
+  m_encoded.resize(size);
+  if (m_file.Seek(m_index[block]) < 0 || m_file.Read(&m_encoded[0], size) != size || size < 4)
+  {
+    CLog::Log(LOGERROR, "Spotifylog: error reading audio cache block %u", block);
+    return false;
+  }
+
+  unsigned int frames = getU32(&m_encoded[0]);
+  if (frames > m_framesPerBlock)
+    return false;
+  m_decoded.resize(frames * m_channels * sizeof(int16_t));
+  int16_t *samples = (int16_t*)&m_decoded[0];
+
+  SpotifyBitReader reader(&m_encoded[0], size);
+  reader.seek(4);
+  for (int channel = 0; channel < m_channels; channel++)
+  {
+    int k = reader.get(8);
+    int16_t sample = (int16_t)(reader.get(8) | (reader.get(8) << 8));
+    if (frames > 0)
+      samples[channel] = sample;
+    for (unsigned int i = 1; i < frames; i++)
+    {
+      uint32_t value = reader.getRice(k);
+      int delta = (value & 1) ? -(int)((value + 1) >> 1) : (int)(value >> 1);
+      sample = (int16_t)(sample + delta);
+      samples[i * m_channels + channel] = sample;
+    }
+    reader.align();
+  }
+
+  m_currentBlock = block;
+  m_decodedPos = 0;
+  return true;
+}
+
+int SpotifyAudioCacheReader::Read(char *data, int size)
+{
+  int read = 0;
+  while (m_isOpen && read < size)
+  {
+    if (m_decodedPos >= (int)m_decoded.size())
+    {
+      if (!decodeBlock(m_currentBlock + 1))
+        break;
+    }
+    int amount = m_decoded.size() - m_decodedPos;
+    if (amount > size - read)
+      amount = size - read;
+    memcpy(data + read, &m_decoded[m_decodedPos], amount);
+    m_decodedPos += amount;
+    read += amount;
+  }
+  return read;
+}
+
+bool SpotifyAudioCacheReader::Seek(int64_t pos)
+{
+  if (!m_isOpen || pos < 0 || pos > m_totalBytes)
+    return false;
+
+  int64_t blockBytes = (int64_t)m_framesPerBlock * m_channels * sizeof(int16_t);
+  unsigned int block = pos / blockBytes;
+  if (block >= m_index.size())
+  {
+    //at the very end
+    m_decoded.clear();
+    m_decodedPos = 0;
+    m_currentBlock = m_index.size();
+    return true;
+  }
+  if (block != m_currentBlock || m_decoded.empty())
+  {
+    if (!decodeBlock(block))
+      return false;
+  }
+  m_decodedPos = pos - block * blockBytes;
+  return true;
+}
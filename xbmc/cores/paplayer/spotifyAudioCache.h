@@ -0,0 +1,127 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+#pragma once
+
+#include "StdString.h"
+#include "FileSystem/File.h"
+#include "utils/CriticalSection.h"
+#include <stdint.h>
+#include <vector>
+#include <map>
+
+//a disk cache for tracks that have been played from start to end
+//the pcm is stored in blocks, every channel delta coded and rice coded, with a seek index at the end
+//
+//file layout:
+//  block 0..n-1 : uint32 frames, per channel { uint8 k, int16 first sample, rice coded deltas }
+//  index        : uint64 file offset of every block
+//  footer       : "SPXC", uint32 version, samplerate, channels, frames per block, blocks, uint64 pcm bytes, index offset
+class SpotifyAudioCache
+{
+public:
+  static bool IsEnabled();
+  static CStdString GetFolder();
+  static bool Has(const CStdString &uri);
+  static CStdString GetFileName(const CStdString &uri);
+  static void Touch(const CStdString &uri);
+  static void Add(const CStdString &uri, int64_t size);
+  static void Remove(const CStdString &uri);
+
+private:
+  struct Entry
+  {
+    int64_t size;
+    unsigned int lastUsed;
+  };
+  static CStdString getKey(const CStdString &uri);
+  static void load();
+  static void save();
+  static void evict();
+
+  static std::map<CStdString, Entry> m_entries;
+  static int64_t m_totalSize;
+  static bool m_isLoaded;
+  static CCriticalSection m_lock;
+};
+
+class SpotifyAudioCacheWriter
+{
+public:
+  SpotifyAudioCacheWriter();
+  ~SpotifyAudioCacheWriter();
+
+  bool Open(const CStdString &uri, int sampleRate, int channels);
+  bool IsOpen(){ return m_isOpen; }
+  int64_t GetBytesWritten(){ return m_totalBytes; }
+  void Write(const char *data, int size);
+  //only call it when the whole track has been written, the entry is added to the cache
+  bool Finish();
+  void Abort();
+
+private:
+  bool encodeBlock();
+
+  CStdString m_uri;
+  CStdString m_tempFile;
+  XFILE::CFile m_file;
+  bool m_isOpen;
+  int m_sampleRate;
+  int m_channels;
+  std::vector<char> m_pending;
+  std::vector<unsigned char> m_encoded;
+  std::vector<uint64_t> m_index;
+  uint64_t m_filePos;
+  uint64_t m_totalBytes;
+};
+
+class SpotifyAudioCacheReader
+{
+public:
+  SpotifyAudioCacheReader();
+  ~SpotifyAudioCacheReader();
+
+  bool Open(const CStdString &uri);
+  void Close();
+  bool IsOpen(){ return m_isOpen; }
+  //returns the number of bytes read, 0 at the end of the track
+  int Read(char *data, int size);
+  bool Seek(int64_t pos);
+  int64_t GetTotalBytes(){ return m_totalBytes; }
+  int GetSampleRate(){ return m_sampleRate; }
+  int GetChannels(){ return m_channels; }
+
+private:
+  bool decodeBlock(unsigned int block);
+
+  XFILE::CFile m_file;
+  bool m_isOpen;
+  int m_sampleRate;
+  int m_channels;
+  unsigned int m_framesPerBlock;
+  int64_t m_totalBytes;
+  uint64_t m_indexOffset;
+  std::vector<uint64_t> m_index;
+  std::vector<unsigned char> m_encoded;
+  std::vector<char> m_decoded;
+  unsigned int m_currentBlock;
+  int m_decodedPos;
+};
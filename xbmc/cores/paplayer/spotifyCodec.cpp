@@ -22,14 +22,22 @@
 #include "spotifyCodec.h"
 #include "FileSystem/FileMusicDatabase.h"
 #include "Util.h"
+#include "AdvancedSettings.h"
+#include "GUISettings.h"
 #include "utils/log.h"
+#include "utils/TimeUtils.h"
+#include "utils/SingleLock.h"
 
 using namespace MUSIC_INFO;
 using namespace XFILE;
 
+//paplayer opens the next track this long before the current one has been delivered, an open before that is a skip
+#define SPOTIFYCODEC_QUEUE_WINDOW 10000
+
 //ugly as hell!
 SpotifyCodec *SpotifyCodec::m_currentPlayer = 0;
-bool SpotifyCodec::playerIsFree = true;
+SpotifyCodec *SpotifyCodec::m_nextPlayer = 0;
+CCriticalSection SpotifyCodec::m_playerLock;
 
 SpotifyCodec::SpotifyCodec()
 {
@@ -40,30 +48,61 @@ SpotifyCodec::SpotifyCodec()
   m_CodecName = "spotify";
   m_TotalTime = 0;
   m_currentTrack = 0;
+  m_trackDuration = 0;
+  m_deliveredPos = 0;
   m_isPlayerLoaded = false;
-  m_buffer = 0;
+  m_isCached = false;
+  m_bufferSize = 0;
+  m_tailSize = 0;
   m_hasPlayer = false;
+  m_startThreshold = 0;
+  m_resumeThreshold = 0;
+  m_underruns = 0;
+  m_initTime = 0;
+  m_underrunTime = 0;
+  m_hasPlayed = false;
+  m_lastDeliveryTime = 0;
+  m_deliveryInterval = 0;
+  m_deliveryJitter = 0;
+  m_history = 0;
+  m_historySize = 0;
+  resetHistory(0);
 }
 
 SpotifyCodec::~SpotifyCodec()
 {
   DeInit();
-  delete m_buffer;
+  delete [] m_history;
 }
 void SpotifyCodec::DeInit()
 {
   CLog::Log( LOGDEBUG, "Spotifylog: deinit");
   if (m_hasPlayer)
     unloadPlayer();
+  m_cacheWriter.Abort();
+  m_cacheReader.Close();
+  m_isCached = false;
 }
 
 bool SpotifyCodec::Init(const CStdString &strFile1, unsigned int filecache)
 {
   CLog::Log( LOGDEBUG, "Spotifylog: init");
+  m_initTime = CTimeUtils::GetTimeMS();
+  m_underrunTime = 0;
+  m_hasPlayed = false;
   if (reconnect())
   {
-    m_bufferSize = 2048 * sizeof(int16_t) * 2 * 10;
-    m_buffer = new char[m_bufferSize];
+    //with crossfade on, the buffer gets room for the end of the track on top of the normal fill
+    m_bufferSize = msToBytes(g_advancedSettings.m_spotifyBufferMs);
+    int crossFade = g_guiSettings.GetInt("musicplayer.crossfade");
+    m_buffer.Create(m_bufferSize + (crossFade > 0 ? msToBytes(crossFade * 1000 + 1000) : 0));
+    m_tailSize = crossFade > 0 ? m_buffer.GetSize() - m_bufferSize : 0;
+    delete [] m_history;
+    m_history = 0;
+    m_historySize = msToBytes(g_advancedSettings.m_spotifySeekHistory * 1000);
+    if (m_historySize > 0)
+      m_history = new char[m_historySize];
+    resetHistory(0);
     CStdString uri = CUtil::GetFileName(strFile1);
     //if its a song from our library we need to get the uri
     if (strFile1.Left(7) == "musicdb")
@@ -74,31 +113,90 @@ bool SpotifyCodec::Init(const CStdString &strFile1, unsigned int filecache)
     }
     CUtil::RemoveExtension(uri);
     CLog::Log(LOGNOTICE, "Spotifylog: loading spotifyCodec, %s", uri.c_str());
+    m_uri = uri;
 
-    if (m_currentPlayer != 0)
-      m_currentPlayer->DeInit();
-    m_currentPlayer = this;
+    m_loudness.Init(uri, m_SampleRate, m_Channels);
 
-    sp_link *spLink = sp_link_create_from_string(uri.c_str());
-    m_currentTrack = sp_link_as_track(spLink);
-    /*if (!sp_track_is_available(m_currentTrack))
+    //have we played it before? then we dont need spotify at all
+    m_isCached = false;
+    if (SpotifyAudioCache::Has(uri) && m_cacheReader.Open(uri))
     {
-      CLog::Log(LOGERROR, "Spotifylog: track is not available in this region");
-      m_currentPlayer = 0;
-      playerIsFree = true;
+      if (m_cacheReader.GetSampleRate() == m_SampleRate && m_cacheReader.GetChannels() == m_Channels)
+      {
+        CLog::Log(LOGDEBUG, "Spotifylog: playing %s from the audio cache", uri.c_str());
+        m_isCached = true;
+        m_totalTime = m_cacheReader.GetTotalBytes() / msToBytes(1000);
+        m_endOfTrack = true;
+        m_startStream = true;
+        m_hasPlayer = false;
+        return true;
+      }
+      m_cacheReader.Close();
+    }
+
+    {
+      CSingleLock lock(g_spotifyInterface->getSessionLock());
+      sp_link *spLink = sp_link_create_from_string(uri.c_str());
+      m_currentTrack = sp_link_as_track(spLink);
+      /*if (!sp_track_is_available(m_currentTrack))
+      {
+        CLog::Log(LOGERROR, "Spotifylog: track is not available in this region");
+        sp_link_release(spLink);
+        return false;
+      }*/
+      sp_track_add_ref(m_currentTrack);
       sp_link_release(spLink);
-      return false;
-    }*/
-    sp_track_add_ref(m_currentTrack);
-    sp_link_release(spLink);
-    m_totalTime = 0.001 * sp_track_duration(m_currentTrack);
+      m_trackDuration = sp_track_duration(m_currentTrack);
+    }
+    m_totalTime = 0.001 * m_trackDuration;
+    m_cacheWriter.Open(uri, m_SampleRate, m_Channels);
     m_endOfTrack = false;
-    m_bufferPos = 0;
     m_startStream = false;
+    m_underruns = 0;
+    m_deliveredPos = 0;
+    m_lastDeliveryTime = 0;
+    m_deliveryInterval = 0;
+    m_deliveryJitter = 0;
+    updateWatermarks();
     m_isPlayerLoaded = false;
-    playerIsFree = false;
     m_hasPlayer = true;
-    loadPlayer();
+
+    bool isCurrent;
+    {
+      CSingleLock lock(m_playerLock);
+      //only one can wait for its turn, an older one gives up and ends
+      if (m_nextPlayer)
+      {
+        CLog::Log(LOGDEBUG, "Spotifylog: dropping the queued track %s", m_nextPlayer->m_uri.c_str());
+        m_nextPlayer->m_endOfTrack = true;
+        m_nextPlayer = 0;
+      }
+
+      isCurrent = m_currentPlayer == 0 || m_currentPlayer->m_endOfTrack;
+      if (!isCurrent && !m_currentPlayer->isNearEnd())
+      {
+        //the user skipped, with crossfade the old track is still fading out, it plays what it has and ends
+        CLog::Log(LOGDEBUG, "Spotifylog: taking the player from %s", m_currentPlayer->m_uri.c_str());
+        m_currentPlayer->m_endOfTrack = true;
+        m_currentPlayer->m_isPlayerLoaded = false;
+        isCurrent = true;
+      }
+      if (isCurrent)
+        m_currentPlayer = this;
+      else
+        m_nextPlayer = this;
+    }
+    if (isCurrent)
+    {
+      //nothing is streaming, take the player right away
+      loadPlayer();
+    }
+    else
+    {
+      //the current track is still streaming, we are the next one in line
+      //the track metadata gets loaded meanwhile and we start in the end of track callback
+      CLog::Log(LOGDEBUG, "Spotifylog: queued next track %s", uri.c_str());
+    }
     return true;
   }
   return false;
@@ -110,50 +208,102 @@ bool SpotifyCodec::loadPlayer()
   if (reconnect())
   {
     if (!m_isPlayerLoaded)
-    {
-      //do we have a track at all?
-      if (m_currentTrack)
-      {
-        CStdString name;
-        if (sp_track_is_loaded(m_currentTrack))
-        {
-          sp_error error = sp_session_player_load (getSession(), m_currentTrack);
-          CStdString message;
-          message.Format("%s",sp_error_message(error));
-          CLog::Log( LOGDEBUG, "Spotifylog: music load player errormessage: %s", message.c_str());
-
-          if(SP_ERROR_OK == error)
-          {
-            if(SP_ERROR_OK == sp_session_player_play (getSession(), true))
-            {
-              CLog::Log( LOGDEBUG, "Spotifylog: music load, play" );
-              m_isPlayerLoaded = true;
-              return true;
-            }
-          }
-        }
-      }else
-        return false;
-    }else
+      return loadTrack();
+    else
       return true;
   }
   return false;
 }
 
+bool SpotifyCodec::loadTrack()
+{
+  //only the current codec may use the player, the next one has to wait for its turn
+  {
+    CSingleLock lock(m_playerLock);
+    if (!m_currentTrack || m_currentPlayer != this)
+      return false;
+  }
+
+  SpotifyCommandPtr command = g_spotifyInterface->postCommand(new SpotifyCodecLoadCommand(this));
+  return command->Wait() == SP_ERROR_OK;
+}
+
+//runs on the session thread
+sp_error SpotifyCodec::playerLoad(sp_session *session)
+{
+  //a load from ReadPCM can be queued after the one from the end of track callback
+  if (m_isPlayerLoaded)
+    return SP_ERROR_OK;
+
+  if (!m_currentTrack || !sp_track_is_loaded(m_currentTrack))
+    return SP_ERROR_OTHER_TRANSIENT;
+  //the duration is not known until the metadata is loaded, the delivery callback reads it
+  //we take the deliveries from here on, what comes before is the end of a track we took the player from
+  {
+    CSingleLock lock(m_playerLock);
+    m_trackDuration = sp_track_duration(m_currentTrack);
+    m_isPlayerLoaded = true;
+  }
+
+  sp_error error = sp_session_player_load (session, m_currentTrack);
+  CStdString message;
+  message.Format("%s",sp_error_message(error));
+  CLog::Log( LOGDEBUG, "Spotifylog: music load player errormessage: %s", message.c_str());
+
+  if(SP_ERROR_OK == error)
+  {
+    error = sp_session_player_play (session, true);
+    if(SP_ERROR_OK == error)
+      CLog::Log( LOGDEBUG, "Spotifylog: music load, play" );
+  }
+  if (SP_ERROR_OK != error)
+    m_isPlayerLoaded = false;
+  return error;
+}
+
+sp_error SpotifyCodecLoadCommand::Execute(sp_session *session)
+{
+  //the codec may have been unloaded while we were in the queue
+  //an unload after this check is queued behind us, so the codec is still there when we load
+  {
+    CSingleLock lock(SpotifyCodec::m_playerLock);
+    if (SpotifyCodec::m_currentPlayer != m_codec)
+      return SP_ERROR_OTHER_TRANSIENT;
+  }
+  return m_codec->playerLoad(session);
+}
+
 bool SpotifyCodec::unloadPlayer()
 {
   CLog::Log( LOGDEBUG, "Spotifylog: music unloadplayer");
-  if (m_isPlayerLoaded && m_hasPlayer)
+  bool wasCurrent;
   {
-    CLog::Log( LOGDEBUG, "Spotifylog: music unloadplayer hasplayer");
-    sp_session_player_play (getSession(), false);
-    sp_session_player_unload (getSession());
-    m_currentPlayer = 0;
-    playerIsFree = true;
+    //the delivery callback stops writing to us from here on
+    CSingleLock lock(m_playerLock);
+    wasCurrent = m_currentPlayer == this;
+    if (wasCurrent)
+      m_currentPlayer = 0;
+    else if (m_nextPlayer == this)
+      m_nextPlayer = 0;
+  }
+
+  if (wasCurrent)
+  {
+    if (m_isPlayerLoaded)
+    {
+      CLog::Log( LOGDEBUG, "Spotifylog: music unloadplayer hasplayer");
+      g_spotifyInterface->postCommand(new SpotifyPlayerUnloadCommand())->Wait();
+    }
+
+    //if a track is queued it can have the player now
+    CSingleLock lock(m_playerLock);
+    if (!m_currentPlayer)
+      startNextPlayer();
   }
 
   if (m_currentTrack)
   {
+    CSingleLock lock(g_spotifyInterface->getSessionLock());
     sp_track_release(m_currentTrack);
   }
 
@@ -164,91 +314,317 @@ bool SpotifyCodec::unloadPlayer()
   return true;
 }
 
+void SpotifyCodec::startNextPlayer()
+{
+  if (!m_nextPlayer)
+    return;
+
+  CLog::Log( LOGDEBUG, "Spotifylog: starting next track");
+  m_currentPlayer = m_nextPlayer;
+  m_nextPlayer = 0;
+  //we are called from the end of track callback, so dont wait for it
+  //if the track metadata is not loaded yet, ReadPCM will try again
+  g_spotifyInterface->postCommand(new SpotifyCodecLoadCommand(m_currentPlayer));
+}
+
 __int64 SpotifyCodec::Seek(__int64 iSeekTime)
 {
+  int frameSize = m_Channels * (m_BitsPerSample / 8);
+  int64_t pos = (int64_t)msToBytes(1000) * iSeekTime / 1000;
+  pos -= pos % frameSize;
+  if (m_isCached)
+    return m_cacheReader.Seek(pos) ? iSeekTime : 0;
+
+  //is it audio we have played recently? then there is no need to bother spotify
+  if (seekInHistory(pos))
+  {
+    CLog::Log( LOGDEBUG, "Spotifylog: history seek, offset %i", (int)iSeekTime);
+    return iSeekTime;
+  }
+
   if (m_hasPlayer && !m_isPlayerLoaded)
     loadPlayer();
 
   if (m_isPlayerLoaded)
   {
-    if (SP_ERROR_OK == sp_session_player_seek (getSession(), iSeekTime))
+    SpotifyCommandPtr command = g_spotifyInterface->postCommand(new SpotifyPlayerSeekCommand((int)iSeekTime));
+    if (SP_ERROR_OK == command->Wait())
     {
       CLog::Log( LOGDEBUG, "Spotifylog: player seek, offset %i", (int)iSeekTime);
-      m_bufferPos = 0;
-      if (SP_ERROR_OK == sp_session_player_play (getSession(), true))
-        return iSeekTime;
+      {
+        CSingleLock lock(m_playerLock);
+        m_buffer.Clear();
+        m_deliveredPos = pos;
+        //the filter history is from before the seek
+        m_resampler.Reset();
+      }
+      resetHistory(pos);
+      //we will not get the whole track in one piece now
+      m_cacheWriter.Abort();
+      //a seek is a fresh start, use the short prebuffer again
+      m_startStream = false;
+      updateWatermarks();
+      return iSeekTime;
     }
   }
   CLog::Log( LOGDEBUG, "Spotifylog: player seek, return false. offset %i", (int)iSeekTime);
   return 0;
 }
 
+//with m_playerLock held
+bool SpotifyCodec::isNearEnd()
+{
+  if (m_trackDuration <= 0)
+    return false;
+  int64_t remaining = (int64_t)msToBytes(m_trackDuration) - m_deliveredPos;
+  return remaining <= m_tailSize + msToBytes(SPOTIFYCODEC_QUEUE_WINDOW);
+}
+
+//called from the music delivery thread with m_playerLock held
+int SpotifyCodec::getWriteSpace()
+{
+  int fill = m_buffer.GetReadSize();
+  int limit = m_bufferSize;
+  if (m_tailSize > 0 && m_trackDuration > 0)
+  {
+    //near the end we take the rest of the track in one go, so end of track comes early
+    //and the next track can start streaming while paplayer fades us out
+    int64_t remaining = (int64_t)msToBytes(m_trackDuration) - m_deliveredPos;
+    if (remaining <= m_tailSize)
+      limit = m_buffer.GetSize();
+  }
+  return fill < limit ? limit - fill : 0;
+}
+
 //music delivery callbacks
 int SpotifyCodec::cb_musicDelivery(sp_session *session, const sp_audioformat *format, const void *frames, int num_frames)
 {
   //CLog::Log( LOGDEBUG, "Spotifylog: music delivery");
+  CSingleLock lock(m_playerLock);
   if (!m_currentPlayer)
   {
-    sp_session_player_play (g_spotifyInterface->getSession(), false);
-    sp_session_player_unload (g_spotifyInterface->getSession());
+    g_spotifyInterface->postCommand(new SpotifyPlayerUnloadCommand());
     return 0;
   }
-  int amountToMove = num_frames * (int)sizeof(int16_t) * format->channels;
-
-  if ((m_currentPlayer->m_bufferPos +  amountToMove) >= m_currentPlayer->m_bufferSize)
+  //a track that took the player over gets nothing until its own track is loaded, the rest of the old one is thrown away
+  if (!m_currentPlayer->m_isPlayerLoaded)
+    return num_frames;
+  //measure how much the time between deliveries varies, the buffer thresholds are adapted to it
+  unsigned int now = CTimeUtils::GetTimeMS();
+  if (m_currentPlayer->m_lastDeliveryTime != 0)
   {
-    amountToMove = m_currentPlayer->m_bufferSize - m_currentPlayer->m_bufferPos;
-    //now the buffer is full, start playing
-    m_currentPlayer->m_startStream = true;
+    int interval = now - m_currentPlayer->m_lastDeliveryTime;
+    int deviation = abs(interval - m_currentPlayer->m_deliveryInterval);
+    m_currentPlayer->m_deliveryInterval += (interval - m_currentPlayer->m_deliveryInterval) / 8;
+    m_currentPlayer->m_deliveryJitter += (deviation - m_currentPlayer->m_deliveryJitter) / 8;
+    SpotifyStats::AddJitter(deviation);
   }
-  m_currentPlayer->m_channels = format->channels;
-  m_currentPlayer->m_sampleRate = format->sample_rate;
-  memcpy (m_currentPlayer->m_buffer + m_currentPlayer->m_bufferPos, frames, amountToMove);
-  m_currentPlayer->m_bufferPos += amountToMove;
+  m_currentPlayer->m_lastDeliveryTime = now;
+
+  //convert to our output format, if libspotify gives us something else
+  SpotifyResampler &resampler = m_currentPlayer->m_resampler;
+  resampler.SetFormat(format->sample_rate, format->channels, m_currentPlayer->m_SampleRate, m_currentPlayer->m_Channels);
+  int frameSize = (int)sizeof(int16_t) * (resampler.IsPassthrough() ? format->channels : m_currentPlayer->m_Channels);
 
-  return amountToMove / ((int)sizeof(int16_t) * format->channels);
+  //only accept whole frames, the rest will be delivered again later
+  int framesToMove = resampler.GetInputFrames(m_currentPlayer->getWriteSpace() / frameSize);
+  if (framesToMove > num_frames)
+    framesToMove = num_frames;
+
+  const int16_t *output;
+  int outputFrames = resampler.Process((const int16_t*)frames, framesToMove, &output);
+  m_currentPlayer->m_buffer.Write(output, outputFrames * frameSize);
+  m_currentPlayer->m_deliveredPos += outputFrames * frameSize;
+  SpotifyStats::AddDelivery(num_frames, framesToMove);
+
+  return framesToMove;
 }
 
 void SpotifyCodec::cb_endOfTrack(sp_session *sess)
 {
   CLog::Log( LOGDEBUG, "Spotifylog: music endoftrack callback");
+  CSingleLock lock(m_playerLock);
   if (!m_currentPlayer)
   {
-    sp_session_player_play (g_spotifyInterface->getSession(), false);
-    sp_session_player_unload (g_spotifyInterface->getSession());
+    g_spotifyInterface->postCommand(new SpotifyPlayerUnloadCommand());
     return;
   }
   m_currentPlayer->m_endOfTrack = true;
-  playerIsFree = true;
+
+  //gapless, load the next track into its own buffer while the old one is still draining
+  startNextPlayer();
 }
 
 int SpotifyCodec::ReadPCM(BYTE *pBuffer, int size, int *actualsize)
 {
   //CLog::Log( LOGDEBUG, "Spotifylog: readpcm");
   *actualsize = 0;
-  if (m_hasPlayer && !m_isPlayerLoaded)
+  if (m_isCached)
+  {
+    *actualsize = m_cacheReader.Read((char*)pBuffer, size);
+    if (*actualsize == 0)
+    {
+      m_loudness.Finish((int)(m_totalTime * 1000));
+      return READ_EOF;
+    }
+    //only fresh audio from spotify is measured
+    m_loudness.Process((int16_t*)pBuffer, *actualsize / sizeof(int16_t), false);
+    return READ_SUCCESS;
+  }
+
+  if (m_hasPlayer && !m_isPlayerLoaded && m_currentPlayer == this)
     loadPlayer();
 
+  //after a seek backwards we first play what we have in the history
+  if (m_isReplaying)
+  {
+    *actualsize = readFromHistory(pBuffer, size);
+    //we have measured this part already
+    m_loudness.Process((int16_t*)pBuffer, *actualsize / sizeof(int16_t), false);
+    return READ_SUCCESS;
+  }
+
+  int fill = m_buffer.GetReadSize();
+  if (!m_startStream)
+  {
+    //wait until we have enough to play without stuttering, or until there is nothing more to wait for
+    if (fill >= m_startThreshold || m_endOfTrack)
+    {
+      CLog::Log( LOGDEBUG, "Spotifylog: buffered %i bytes, start playing", fill);
+      m_startStream = true;
+      if (m_underrunTime)
+        SpotifyStats::AddRebufferTime(CTimeUtils::GetTimeMS() - m_underrunTime);
+      m_underrunTime = 0;
+    }
+  }
+
   if (m_startStream)
   {
-    if (m_endOfTrack && m_bufferPos == 0)
+    if (m_endOfTrack && fill == 0)
     {
+      //only complete tracks are worth caching
+      if (m_cacheWriter.IsOpen() && m_cacheWriter.GetBytesWritten() >= msToBytes(m_trackDuration - 1000))
+        m_cacheWriter.Finish();
+      m_cacheWriter.Abort();
+      m_loudness.Finish(m_trackDuration);
       return READ_EOF;
     }
-    else if (m_bufferPos > 0)
+    SpotifyStats::AddRead(m_bufferSize ? (int)((int64_t)fill * 100 / m_bufferSize) : 0);
+    *actualsize = m_buffer.Read(pBuffer, size);
+    if (*actualsize > 0 && !m_hasPlayed)
     {
-      int amountToMove = m_bufferPos;
-      if (m_bufferPos > size)
-        amountToMove = size;
-      memcpy (pBuffer, m_buffer, amountToMove);
-      memmove(m_buffer, m_buffer + amountToMove, m_bufferSize - amountToMove);
-      m_bufferPos -= amountToMove;
-      *actualsize = amountToMove;
+      m_hasPlayed = true;
+      SpotifyStats::AddStartLatency(CTimeUtils::GetTimeMS() - m_initTime);
+    }
+    //the history and the audio cache get the track as it is, the gain is applied on the way out
+    addToHistory(pBuffer, *actualsize);
+    m_cacheWriter.Write((char*)pBuffer, *actualsize);
+    m_loudness.Process((int16_t*)pBuffer, *actualsize / sizeof(int16_t), true);
+
+    //underrun, go back to buffering with a higher threshold
+    if (*actualsize == 0 && !m_endOfTrack && m_isPlayerLoaded)
+    {
+      m_underruns++;
+      m_underrunTime = CTimeUtils::GetTimeMS();
+      SpotifyStats::AddUnderrun();
+      m_startStream = false;
+      updateWatermarks();
+      m_startThreshold = m_resumeThreshold;
+      CLog::Log( LOGDEBUG, "Spotifylog: buffer underrun %i, rebuffering %i bytes", m_underruns, m_startThreshold);
     }
   }
   return READ_SUCCESS;
 }
 
+void SpotifyCodec::resetHistory(int64_t pos)
+{
+  m_historyStart = pos;
+  m_trackPos = pos;
+  m_replayPos = pos;
+  m_isReplaying = false;
+}
+
+void SpotifyCodec::addToHistory(const BYTE *data, int size)
+{
+  if (!m_history || size <= 0)
+    return;
+
+  //only the end is kept if there is more than we can hold
+  if (size > m_historySize)
+  {
+    m_trackPos += size - m_historySize;
+    data += size - m_historySize;
+    size = m_historySize;
+  }
+
+  int start = (int)(m_trackPos % m_historySize);
+  int first = m_historySize - start;
+  if (first > size)
+    first = size;
+  memcpy(m_history + start, data, first);
+  if (size > first)
+    memcpy(m_history, data + first, size - first);
+
+  m_trackPos += size;
+  if (m_trackPos - m_historyStart > m_historySize)
+    m_historyStart = m_trackPos - m_historySize;
+  m_replayPos = m_trackPos;
+}
+
+int SpotifyCodec::readFromHistory(BYTE *data, int size)
+{
+  int64_t available = m_trackPos - m_replayPos;
+  if (size > available)
+    size = (int)available;
+
+  int start = (int)(m_replayPos % m_historySize);
+  int first = m_historySize - start;
+  if (first > size)
+    first = size;
+  memcpy(data, m_history + start, first);
+  if (size > first)
+    memcpy(data + first, m_history, size - first);
+
+  m_replayPos += size;
+  //when we have caught up, continue with the stream
+  if (m_replayPos >= m_trackPos)
+    m_isReplaying = false;
+  return size;
+}
+
+bool SpotifyCodec::seekInHistory(int64_t pos)
+{
+  if (!m_history || pos < m_historyStart || pos > m_trackPos)
+    return false;
+
+  m_replayPos = pos;
+  m_isReplaying = m_replayPos < m_trackPos;
+  return true;
+}
+
+int SpotifyCodec::msToBytes(int ms)
+{
+  return (int)((int64_t)ms * m_SampleRate * m_Channels * (m_BitsPerSample / 8) / 1000);
+}
+
+void SpotifyCodec::updateWatermarks()
+{
+  //the more jittery the deliveries are, the more we need to have buffered
+  int jitter = m_deliveryJitter;
+  m_startThreshold = msToBytes(g_advancedSettings.m_spotifyPrebufferMs + 2 * jitter);
+
+  //every underrun makes us more careful for the rest of the track
+  m_resumeThreshold = msToBytes(g_advancedSettings.m_spotifyResumeBufferMs + 4 * jitter);
+  m_resumeThreshold += m_underruns * msToBytes(g_advancedSettings.m_spotifyResumeBufferMs) / 2;
+
+  //never wait for more than the buffer can hold
+  int maxThreshold = m_bufferSize * 3 / 4;
+  if (m_startThreshold > maxThreshold)
+    m_startThreshold = maxThreshold;
+  if (m_resumeThreshold > maxThreshold)
+    m_resumeThreshold = maxThreshold;
+}
+
 bool SpotifyCodec::CanInit()
 {
   return reconnect();
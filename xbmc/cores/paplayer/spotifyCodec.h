@@ -23,9 +23,28 @@
 
 #include "CachingCodec.h"
 #include "spotinterface.h"
+#include "spotifyRingBuffer.h"
+#include "spotifyAudioCache.h"
+#include "spotifyResampler.h"
+#include "spotifyLoudness.h"
+#include "spotifyStats.h"
+
+class SpotifyCodec;
+
+//loads and starts a codecs track on the session thread, if it still is the current player by then
+class SpotifyCodecLoadCommand : public SpotifyCommand
+{
+public:
+  SpotifyCodecLoadCommand(SpotifyCodec *codec) : m_codec(codec) {}
+  virtual sp_error Execute(sp_session *session);
+private:
+  SpotifyCodec *m_codec;
+};
 
 class SpotifyCodec : public CachingCodec
 {
+  friend class SpotifyCodecLoadCommand;
+
 public:
   SpotifyCodec();
   virtual ~SpotifyCodec();
@@ -37,9 +56,12 @@ public:
   virtual int ReadPCM(BYTE *pBuffer, int size, int *actualsize);
   virtual bool CanInit();
 
-  static bool spotifyPlayerIsFree(){ return playerIsFree; }
+  //the codec streaming from libspotify and the one queued up to take over when it is done
+  //they change hands on the paplayer, session and delivery threads, always under m_playerLock
+  //never wait for the session thread while holding it, the load command takes it too
   static SpotifyCodec *m_currentPlayer;
-  static bool playerIsFree;
+  static SpotifyCodec *m_nextPlayer;
+  static CCriticalSection m_playerLock;
   static int SP_CALLCONV cb_musicDelivery(sp_session *session, const sp_audioformat *format, const void *frames, int num_frames);
   static void SP_CALLCONV cb_endOfTrack(sp_session *sess);
 
@@ -50,19 +72,68 @@ private:
   sp_session * getSession(){ return g_spotifyInterface->getSession(); }
   bool reconnect(){ return g_spotifyInterface->reconnect(); }
   bool loadPlayer();
+  bool loadTrack();
+  sp_error playerLoad(sp_session *session);
   bool unloadPlayer();
+  //the caller holds m_playerLock
+  static void startNextPlayer();
+
+  //buffering
+  int msToBytes(int ms);
+  //true if paplayer could be opening the next track by now, else an open is a skip
+  bool isNearEnd();
+  int getWriteSpace();
+  void updateWatermarks();
+
+  //seek history
+  void addToHistory(const BYTE *data, int size);
+  int readFromHistory(BYTE *data, int size);
+  bool seekInHistory(int64_t pos);
+  void resetHistory(int64_t pos);
 
   sp_track *m_currentTrack;
-  int m_sampleRate;
-  int m_channels;
-  int m_bitsPerSample;
-  int m_bitrate;
+  CStdString m_uri;
+  int m_trackDuration;
   int64_t m_totalTime;
   bool m_hasPlayer;
-  bool m_startStream;
-  bool m_isPlayerLoaded;
-  bool m_endOfTrack;
+  volatile bool m_startStream;
+  volatile bool m_isPlayerLoaded;
+  volatile bool m_endOfTrack;
   int m_bufferSize;
-  char *m_buffer;
-  int m_bufferPos;
+  //extra room used only for the last part of the track when crossfading
+  int m_tailSize;
+  SpotifyRingBuffer m_buffer;
+  //libspotify can deliver other formats than the 44.1 kHz stereo we tell paplayer about
+  SpotifyResampler m_resampler;
+
+  //playback starts when the buffer holds m_startThreshold bytes, after an underrun we wait for m_resumeThreshold
+  int m_startThreshold;
+  int m_resumeThreshold;
+  int m_underruns;
+  //for the stats, when Init was called and when the last underrun happened
+  unsigned int m_initTime;
+  unsigned int m_underrunTime;
+  bool m_hasPlayed;
+  unsigned int m_lastDeliveryTime;
+  int m_deliveryInterval;
+  volatile int m_deliveryJitter;
+
+  //the last played audio of the track, so we can seek backwards without asking spotify
+  //m_historyStart and m_trackPos are byte offsets into the track, m_replayPos is where we read when replaying
+  char *m_history;
+  int m_historySize;
+  int64_t m_historyStart;
+  int64_t m_trackPos;
+  //where in the track the delivered audio ends, it is only used with m_playerLock held
+  int64_t m_deliveredPos;
+  int64_t m_replayPos;
+  bool m_isReplaying;
+
+  //tracks played from start to end are written to the audio cache, and played from it the next time
+  bool m_isCached;
+  SpotifyAudioCacheReader m_cacheReader;
+  SpotifyAudioCacheWriter m_cacheWriter;
+
+  //levels tracks against each other, applied to everything we hand to paplayer
+  SpotifyLoudness m_loudness;
 };
@@ -0,0 +1,327 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+#include "spotifyLoudness.h"
+#include "AdvancedSettings.h"
+#include "FileSystem/File.h"
+#include "FileSystem/Directory.h"
+#include "Util.h"
+#include "utils/SingleLock.h"
+#include "utils/log.h"
+#include <math.h>
+#include <stdio.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SPOTIFY_HAS_SSE2
+#endif
+
+using namespace std;
+using namespace XFILE;
+
+#define SPOTIFY_LOUDNESS_BLOCK_MS 400
+//blocks quieter than this are silence and do not count
+#define SPOTIFY_LOUDNESS_GATE_DB -70.0
+//we need this much before we trust the measurement
+#define SPOTIFY_LOUDNESS_MIN_MS 3000
+#define SPOTIFY_LOUDNESS_MAX_GAIN_DB 12.0
+//how fast the gain may change while we are still measuring
+#define SPOTIFY_LOUDNESS_DB_PER_SECOND 1.0
+
+map<CStdString, float> SpotifyLoudness::m_gains;
+bool SpotifyLoudness::m_isLoaded = false;
+CCriticalSection SpotifyLoudness::m_lock;
+
+SpotifyLoudness::SpotifyLoudness()
+{
+  m_sampleRate = 44100;
+  m_channels = 2;
+  m_isKnown = false;
+  m_blockSize = 0;
+  m_blockSamples = 0;
+  m_blockSquares = 0;
+  m_gatedSum = 0.0;
+  m_gatedBlocks = 0;
+  m_peak = 0;
+  m_analyzedSamples = 0;
+  m_gain = 1.0f;
+  m_wantedGain = 1.0f;
+}
+
+bool SpotifyLoudness::IsEnabled()
+{
+  return g_advancedSettings.m_spotifyNormalize;
+}
+
+void SpotifyLoudness::Init(const CStdString &uri, int sampleRate, int channels)
+{
+  m_uri = uri;
+  m_sampleRate = sampleRate;
+  m_channels = channels;
+  m_blockSize = sampleRate * channels * SPOTIFY_LOUDNESS_BLOCK_MS / 1000;
+  m_blockSamples = 0;
+  m_blockSquares = 0;
+  m_gatedSum = 0.0;
+  m_gatedBlocks = 0;
+  m_peak = 0;
+  m_analyzedSamples = 0;
+  m_gain = 1.0f;
+  m_wantedGain = 1.0f;
+  m_isKnown = false;
+
+  float gain;
+  if (IsEnabled() && lookup(uri, gain))
+  {
+    CLog::Log(LOGDEBUG, "Spotifylog: stored gain %.1f dB for %s", 20.0 * log10(gain), uri.c_str());
+    m_gain = m_wantedGain = gain;
+    m_isKnown = true;
+  }
+}
+
+void SpotifyLoudness::Process(int16_t *data, int samples, bool analyze)
+{
+  if (!IsEnabled() || samples <= 0)
+    return;
+  analyze = analyze && !m_isKnown;
+
+  while (samples > 0)
+  {
+    //dont let a chunk cross a block border, and keep whole frames together
+    int count = samples;
+    if (analyze && count > m_blockSize - m_blockSamples)
+      count = m_blockSize - m_blockSamples;
+    count -= count % m_channels;
+    if (count <= 0)
+      count = samples;
+
+    //ramp towards the wanted gain, but not faster than SPOTIFY_LOUDNESS_DB_PER_SECOND
+    float gain = m_gain;
+    if (m_gain != m_wantedGain)
+    {
+      double maxDb = SPOTIFY_LOUDNESS_DB_PER_SECOND * count / (m_sampleRate * m_channels);
+      double diffDb = 20.0 * log10(m_wantedGain / m_gain);
+      if (diffDb > maxDb)
+        diffDb = maxDb;
+      else if (diffDb < -maxDb)
+        diffDb = -maxDb;
+      m_gain = (float)(m_gain * pow(10.0, diffDb / 20.0));
+    }
+    float step = count >= 8 ? (m_gain - gain) / (count / 8) : 0.0f;
+
+    int peak = 0;
+    uint64_t squares = ApplyGain(data, count, gain, step, &peak);
+    if (analyze)
+    {
+      m_blockSquares += squares;
+      m_blockSamples += count;
+      m_analyzedSamples += count;
+      if (peak > m_peak)
+        m_peak = peak;
+      if (m_blockSamples >= m_blockSize)
+        endBlock();
+    }
+    data += count;
+    samples -= count;
+  }
+}
+
+void SpotifyLoudness::endBlock()
+{
+  double meanSquare = (double)m_blockSquares / m_blockSamples / (32768.0 * 32768.0);
+  m_blockSquares = 0;
+  m_blockSamples = 0;
+  if (meanSquare > pow(10.0, SPOTIFY_LOUDNESS_GATE_DB / 10.0))
+  {
+    m_gatedSum += meanSquare;
+    m_gatedBlocks++;
+  }
+  if ((int64_t)m_analyzedSamples * 1000 >= (int64_t)SPOTIFY_LOUDNESS_MIN_MS * m_sampleRate * m_channels)
+    m_wantedGain = getWantedGain();
+}
+
+float SpotifyLoudness::getWantedGain()
+{
+  if (m_gatedBlocks == 0)
+    return 1.0f;
+  double loudness = 10.0 * log10(m_gatedSum / m_gatedBlocks);
+  double gainDb = g_advancedSettings.m_spotifyNormalizeTarget - loudness;
+  if (gainDb > SPOTIFY_LOUDNESS_MAX_GAIN_DB)
+    gainDb = SPOTIFY_LOUDNESS_MAX_GAIN_DB;
+  else if (gainDb < -SPOTIFY_LOUDNESS_MAX_GAIN_DB)
+    gainDb = -SPOTIFY_LOUDNESS_MAX_GAIN_DB;
+
+  //dont push the peaks into clipping
+  if (m_peak > 0)
+  {
+    double headroomDb = 20.0 * log10(32767.0 / m_peak);
+    if (gainDb > headroomDb)
+      gainDb = headroomDb;
+  }
+  return (float)pow(10.0, gainDb / 20.0);
+}
+
+void SpotifyLoudness::Finish(int trackDuration)
+{
+  if (!IsEnabled() || m_isKnown || m_uri.IsEmpty())
+    return;
+  //half the track is enough, the user might have skipped the intro
+  int64_t analyzedMs = m_analyzedSamples * 1000 / (m_sampleRate * m_channels);
+  if (analyzedMs < SPOTIFY_LOUDNESS_MIN_MS || analyzedMs < trackDuration / 2)
+    return;
+
+  float gain = getWantedGain();
+  CLog::Log(LOGDEBUG, "Spotifylog: measured gain %.1f dB for %s", 20.0 * log10(gain), m_uri.c_str());
+  store(m_uri, gain);
+  m_isKnown = true;
+}
+
+uint64_t SpotifyLoudness::ApplyGain(int16_t *data, int samples, float gain, float step, int *peak)
+{
+  uint64_t squares = 0;
+  int maxSample = 0;
+  int minSample = 0;
+  bool unity = gain == 1.0f && step == 0.0f;
+  int i = 0;
+#ifdef SPOTIFY_HAS_SSE2
+  __m128i zero = _mm_setzero_si128();
+  __m128i acc = _mm_setzero_si128();
+  __m128i vmax = _mm_setzero_si128();
+  __m128i vmin = _mm_setzero_si128();
+  for (; i + 8 <= samples; i += 8, gain += step)
+  {
+    __m128i s = _mm_loadu_si128((const __m128i*)(data + i));
+    //a*a + b*b is at most 2^31, so it fits when we read it as unsigned
+    __m128i sq = _mm_madd_epi16(s, s);
+    acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+    vmax = _mm_max_epi16(vmax, s);
+    vmin = _mm_min_epi16(vmin, s);
+    if (unity)
+      continue;
+
+    __m128 vgain = _mm_set1_ps(gain);
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+    lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(lo), vgain));
+    hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(hi), vgain));
+    _mm_storeu_si128((__m128i*)(data + i), _mm_packs_epi32(lo, hi));
+  }
+  uint64_t lanes[2];
+  _mm_storeu_si128((__m128i*)lanes, acc);
+  squares = lanes[0] + lanes[1];
+  int16_t maxLanes[8], minLanes[8];
+  _mm_storeu_si128((__m128i*)maxLanes, vmax);
+  _mm_storeu_si128((__m128i*)minLanes, vmin);
+  for (int j = 0; j < 8; j++)
+  {
+    if (maxLanes[j] > maxSample)
+      maxSample = maxLanes[j];
+    if (minLanes[j] < minSample)
+      minSample = minLanes[j];
+  }
+#endif
+  for (; i < samples; i++)
+  {
+    int sample = data[i];
+    squares += (uint64_t)(sample * sample);
+    if (sample > maxSample)
+      maxSample = sample;
+    if (sample < minSample)
+      minSample = sample;
+    if (unity)
+      continue;
+
+    float scaled = floorf(sample * gain + 0.5f);
+    data[i] = scaled >= 32767.0f ? 32767 : scaled <= -32768.0f ? -32768 : (int16_t)scaled;
+    //the simd loop moves the gain every 8 samples, do the same here
+    if ((i & 7) == 7)
+      gain += step;
+  }
+  *peak = maxSample > -minSample ? maxSample : -minSample;
+  return squares;
+}
+
+//the stored gains, a text file with one "id gain" line per track
+CStdString SpotifyLoudness::getKey(const CStdString &uri)
+{
+  int pos = uri.ReverseFind(':');
+  return pos >= 0 ? uri.Mid(pos + 1) : uri;
+}
+
+CStdString SpotifyLoudness::getFileName()
+{
+  return CUtil::AddFileToFolder(g_advancedSettings.m_spotifyCacheFolder, "loudness");
+}
+
+void SpotifyLoudness::load()
+{
+  if (m_isLoaded)
+    return;
+  m_isLoaded = true;
+  m_gains.clear();
+
+  CFile file;
+  if (!file.Open(getFileName()))
+    return;
+
+  char line[256];
+  while (file.ReadString(line, sizeof(line)))
+  {
+    char key[128];
+    float gain;
+    if (sscanf(line, "%127s %f", key, &gain) == 2 && gain > 0.0f)
+      m_gains[key] = gain;
+  }
+  file.Close();
+}
+
+bool SpotifyLoudness::lookup(const CStdString &uri, float &gain)
+{
+  CSingleLock lock(m_lock);
+  load();
+  map<CStdString, float>::iterator it = m_gains.find(getKey(uri));
+  if (it == m_gains.end())
+    return false;
+  gain = it->second;
+  return true;
+}
+
+void SpotifyLoudness::store(const CStdString &uri, float gain)
+{
+  CSingleLock lock(m_lock);
+  load();
+  m_gains[getKey(uri)] = gain;
+
+  CDirectory::Create(g_advancedSettings.m_spotifyCacheFolder);
+  CFile file;
+  if (!file.OpenForWrite(getFileName(), true))
+  {
+    CLog::Log(LOGERROR, "Spotifylog: could not write the loudness file");
+    return;
+  }
+  for (map<CStdString, float>::iterator it = m_gains.begin(); it != m_gains.end(); ++it)
+  {
+    CStdString line;
+    line.Format("%s %f\n", it->first.c_str(), it->second);
+    file.Write(line.c_str(), line.size());
+  }
+  file.Close();
+}
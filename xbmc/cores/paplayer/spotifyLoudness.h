@@ -0,0 +1,80 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+#pragma once
+
+#include "StdString.h"
+#include "utils/CriticalSection.h"
+#include <stdint.h>
+#include <map>
+
+//spotify tracks have no replaygain, so we measure the loudness while we play and level it out
+//the measurement is the gated mean square of 400 ms blocks, like ebu r128 but without the k weighting
+//when a track has been measured the gain is stored by uri, the next time it starts at the right level
+class SpotifyLoudness
+{
+public:
+  SpotifyLoudness();
+
+  static bool IsEnabled();
+
+  void Init(const CStdString &uri, int sampleRate, int channels);
+  bool IsKnown(){ return m_isKnown; }
+  //applies the gain in place, when analyze is set the samples are measured in the same pass
+  void Process(int16_t *data, int samples, bool analyze);
+  //stores the gain if we have heard enough of the track
+  void Finish(int trackDuration);
+
+  //the kernel, measures the input and writes it back with a gain that goes from gain by step every 8 samples
+  static uint64_t ApplyGain(int16_t *data, int samples, float gain, float step, int *peak);
+
+private:
+  void endBlock();
+  float getWantedGain();
+
+  static bool lookup(const CStdString &uri, float &gain);
+  static void store(const CStdString &uri, float gain);
+  static CStdString getKey(const CStdString &uri);
+  static CStdString getFileName();
+  static void load();
+
+  CStdString m_uri;
+  int m_sampleRate;
+  int m_channels;
+  bool m_isKnown;
+
+  //analysis
+  int m_blockSize;
+  int m_blockSamples;
+  uint64_t m_blockSquares;
+  double m_gatedSum;
+  int m_gatedBlocks;
+  int m_peak;
+  int64_t m_analyzedSamples;
+
+  //the gain we play with now, it moves slowly towards m_wantedGain, both linear
+  float m_gain;
+  float m_wantedGain;
+
+  static std::map<CStdString, float> m_gains;
+  static bool m_isLoaded;
+  static CCriticalSection m_lock;
+};
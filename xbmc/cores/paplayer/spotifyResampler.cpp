@@ -0,0 +1,455 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+#include "spotifyResampler.h"
+#include "utils/log.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef SPOTIFY_HAS_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static int gcd(int a, int b)
+{
+  while (b)
+  {
+    int t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+SpotifyResampler::SpotifyResampler()
+{
+  m_inRate = m_outRate = 44100;
+  m_inChannels = m_outChannels = 2;
+  m_isSupported = true;
+  m_up = m_down = 1;
+  m_phase = 0;
+  m_inputPos = 0;
+}
+
+SpotifyResampler::~SpotifyResampler()
+{
+}
+
+bool SpotifyResampler::SetFormat(int inRate, int inChannels, int outRate, int outChannels)
+{
+  if (inRate == m_inRate && inChannels == m_inChannels && outRate == m_outRate && outChannels == m_outChannels)
+    return true;
+
+  bool supported = inRate > 0 && outRate > 0 && inChannels >= 1 && inChannels <= 2
+                && (outChannels == inChannels || (inChannels == 1 && outChannels == 2));
+  int up = 1, down = 1;
+  if (supported)
+  {
+    int div = gcd(outRate, inRate);
+    up = outRate / div;
+    down = inRate / div;
+    supported = up <= SPOTIFY_RESAMPLER_MAX_PHASES;
+  }
+
+  m_inRate = inRate;
+  m_inChannels = inChannels;
+  m_outRate = outRate;
+  m_outChannels = outChannels;
+  m_isSupported = supported;
+  if (!supported)
+  {
+    //play it as it is, it will sound wrong but at least we hear something
+    CLog::Log(LOGERROR, "Spotifylog: cant convert %i Hz %i channels to %i Hz %i channels", inRate, inChannels, outRate, outChannels);
+    return false;
+  }
+
+  CLog::Log(LOGDEBUG, "Spotifylog: converting %i Hz %i channels to %i Hz %i channels", inRate, inChannels, outRate, outChannels);
+  m_up = up;
+  m_down = down;
+  if (m_inRate != m_outRate)
+    buildFilter();
+  Reset();
+  return true;
+}
+
+void SpotifyResampler::Reset()
+{
+  m_phase = 0;
+  m_inputPos = SPOTIFY_RESAMPLER_TAPS - 1;
+  m_history.assign((SPOTIFY_RESAMPLER_TAPS - 1) * m_inChannels, 0.0f);
+}
+
+//a blackman windowed sinc, split into m_up branches of SPOTIFY_RESAMPLER_TAPS taps
+//the cutoff is the lower of the two nyquist frequencies, with some room for the transition band
+void SpotifyResampler::buildFilter()
+{
+  int length = SPOTIFY_RESAMPLER_TAPS * m_up;
+  double center = 0.5 * length;
+  double cutoff = (m_up < m_down ? (double)m_up / m_down : 1.0) * 0.95;
+
+  std::vector<double> prototype(length);
+  for (int k = 0; k < length; k++)
+  {
+    double t = (k - center) / m_up * cutoff;
+    double sinc = t == 0.0 ? 1.0 : sin(M_PI * t) / (M_PI * t);
+    double window = 0.42 - 0.5 * cos(2.0 * M_PI * k / length) + 0.08 * cos(4.0 * M_PI * k / length);
+    prototype[k] = cutoff * sinc * window;
+  }
+
+  //branch p gets taps p, p + up, p + 2up..., reversed so they line up with the history oldest first
+  int channels = m_inChannels;
+  m_filter.resize(length * channels);
+  for (int phase = 0; phase < m_up; phase++)
+  {
+    double sum = 0.0;
+    for (int j = 0; j < SPOTIFY_RESAMPLER_TAPS; j++)
+      sum += prototype[phase + j * m_up];
+
+    //every branch gets unity gain, else we get a tone at the input rate
+    for (int j = 0; j < SPOTIFY_RESAMPLER_TAPS; j++)
+    {
+      float tap = (float)(prototype[phase + j * m_up] / sum);
+      int t = SPOTIFY_RESAMPLER_TAPS - 1 - j;
+      for (int c = 0; c < channels; c++)
+        m_filter[(phase * SPOTIFY_RESAMPLER_TAPS + t) * channels + c] = tap;
+    }
+  }
+}
+
+int SpotifyResampler::GetInputFrames(int outFrames)
+{
+  if (!m_isSupported || m_inRate == m_outRate)
+    return outFrames;
+  //resample can give us two frames more than the ratio says
+  if (outFrames <= 2)
+    return 0;
+  return (int)((int64_t)(outFrames - 2) * m_down / m_up);
+}
+
+int SpotifyResampler::Process(const int16_t *in, int frames, const int16_t **out)
+{
+  *out = in;
+  if (IsPassthrough() || frames <= 0)
+    return frames;
+
+  const int16_t *data = in;
+  int outFrames = frames;
+  if (m_inRate != m_outRate)
+  {
+    outFrames = resample(in, frames);
+    if (outFrames == 0)
+      return 0;
+    data = &m_output[0];
+  }
+
+  if (m_inChannels == 1 && m_outChannels == 2)
+  {
+    m_upmix.resize(outFrames * 2);
+    MonoToStereo(data, &m_upmix[0], outFrames);
+    data = &m_upmix[0];
+  }
+
+  *out = data;
+  return outFrames;
+}
+
+int SpotifyResampler::resample(const int16_t *in, int frames)
+{
+  int channels = m_inChannels;
+  int keep = SPOTIFY_RESAMPLER_TAPS - 1;
+  int branchSize = SPOTIFY_RESAMPLER_TAPS * channels;
+  int total = keep + frames;
+
+  m_history.resize(total * channels);
+  Int16ToFloat(in, &m_history[keep * channels], frames * channels);
+
+  int maxOut = (int)((int64_t)frames * m_up / m_down) + 2;
+  m_resampled.resize(maxOut * channels);
+
+  //m_inputPos is the newest history frame the next output frame uses and m_phase its branch
+  int outFrames = 0;
+  while (m_inputPos < total && outFrames < maxOut)
+  {
+    DotProduct(&m_filter[m_phase * branchSize], &m_history[(m_inputPos - keep) * channels], branchSize, channels, &m_resampled[outFrames * channels]);
+    outFrames++;
+    m_phase += m_down;
+    m_inputPos += m_phase / m_up;
+    m_phase %= m_up;
+  }
+
+  //keep the newest frames for the next delivery
+  memmove(&m_history[0], &m_history[frames * channels], keep * channels * sizeof(float));
+  m_history.resize(keep * channels);
+  m_inputPos -= frames;
+
+  m_output.resize(maxOut * channels);
+  if (outFrames > 0)
+    FloatToInt16(&m_resampled[0], &m_output[0], outFrames * channels);
+  return outFrames;
+}
+
+void SpotifyResampler::MonoToStereo(const int16_t *in, int16_t *out, int frames)
+{
+  int i = 0;
+#ifdef SPOTIFY_HAS_SSE2
+  for (; i + 8 <= frames; i += 8)
+  {
+    __m128i mono = _mm_loadu_si128((const __m128i*)(in + i));
+    _mm_storeu_si128((__m128i*)(out + 2 * i), _mm_unpacklo_epi16(mono, mono));
+    _mm_storeu_si128((__m128i*)(out + 2 * i + 8), _mm_unpackhi_epi16(mono, mono));
+  }
+#endif
+  for (; i < frames; i++)
+  {
+    out[2 * i] = in[i];
+    out[2 * i + 1] = in[i];
+  }
+}
+
+void SpotifyResampler::Int16ToFloat(const int16_t *in, float *out, int samples)
+{
+  const float scale = 1.0f / 32768.0f;
+  int i = 0;
+#ifdef SPOTIFY_HAS_SSE2
+  const __m128 vscale = _mm_set1_ps(scale);
+  for (; i + 8 <= samples; i += 8)
+  {
+    __m128i s = _mm_loadu_si128((const __m128i*)(in + i));
+    //sign extend to 32 bits by putting the sample in the high half and shifting it down
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), vscale));
+    _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), vscale));
+  }
+#endif
+  for (; i < samples; i++)
+    out[i] = in[i] * scale;
+}
+
+void SpotifyResampler::FloatToInt16(const float *in, int16_t *out, int samples)
+{
+  int i = 0;
+#ifdef SPOTIFY_HAS_SSE2
+  const __m128 vscale = _mm_set1_ps(32768.0f);
+  for (; i + 8 <= samples; i += 8)
+  {
+    //cvtps rounds to nearest and packs saturates, so clipping comes for free
+    __m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i), vscale));
+    __m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i + 4), vscale));
+    _mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(lo, hi));
+  }
+#endif
+  for (; i < samples; i++)
+  {
+    float sample = in[i] * 32768.0f;
+    if (sample >= 32767.0f)
+      out[i] = 32767;
+    else if (sample <= -32768.0f)
+      out[i] = -32768;
+    else
+      out[i] = (int16_t)floorf(sample + 0.5f);
+  }
+}
+
+void SpotifyResampler::DotProduct(const float *a, const float *b, int size, int channels, float *out)
+{
+  for (int c = 0; c < channels; c++)
+    out[c] = 0.0f;
+
+  int i = 0;
+#ifdef SPOTIFY_HAS_SSE2
+  //with interleaved stereo the even lanes hold the left sum and the odd lanes the right
+  __m128 acc = _mm_setzero_ps();
+  for (; i + 4 <= size; i += 4)
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+  float lanes[4];
+  _mm_storeu_ps(lanes, acc);
+  if (channels == 1)
+    out[0] = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  else
+  {
+    out[0] = lanes[0] + lanes[2];
+    out[1] = lanes[1] + lanes[3];
+  }
+#endif
+  for (; i < size; i++)
+    out[i % channels] += a[i] * b[i];
+}
+
+//the plain c versions of the kernels, the self test holds the simd ones against these
+static void refMonoToStereo(const int16_t *in, int16_t *out, int frames)
+{
+  for (int i = 0; i < frames; i++)
+    out[2 * i] = out[2 * i + 1] = in[i];
+}
+
+static void refInt16ToFloat(const int16_t *in, float *out, int samples)
+{
+  for (int i = 0; i < samples; i++)
+    out[i] = in[i] / 32768.0f;
+}
+
+static int refFloatToInt16(float in)
+{
+  double sample = floor(in * 32768.0 + 0.5);
+  return sample > 32767.0 ? 32767 : (sample < -32768.0 ? -32768 : (int)sample);
+}
+
+bool SpotifyResampler::SelfTest()
+{
+  bool ok = true;
+  //odd sizes so both the simd loops and the tails get used
+  const int samples = 1003;
+  std::vector<int16_t> in16(samples);
+  std::vector<float> inFloat(samples);
+  std::vector<float> taps(samples);
+  for (int i = 0; i < samples; i++)
+  {
+    in16[i] = (int16_t)(rand() % 65536 - 32768);
+    //a bit over full scale so the clipping is tested too
+    inFloat[i] = (rand() / (float)RAND_MAX - 0.5f) * 2.2f;
+    taps[i] = rand() / (float)RAND_MAX - 0.5f;
+  }
+  in16[0] = -32768;
+  in16[1] = 32767;
+
+  std::vector<int16_t> stereo(samples * 2), refStereo(samples * 2);
+  MonoToStereo(&in16[0], &stereo[0], samples);
+  refMonoToStereo(&in16[0], &refStereo[0], samples);
+  if (stereo != refStereo)
+  {
+    CLog::Log(LOGERROR, "Spotifylog: resampler self test, mono to stereo differs from plain c");
+    ok = false;
+  }
+
+  std::vector<float> floats(samples), refFloats(samples);
+  Int16ToFloat(&in16[0], &floats[0], samples);
+  refInt16ToFloat(&in16[0], &refFloats[0], samples);
+  if (floats != refFloats)
+  {
+    CLog::Log(LOGERROR, "Spotifylog: resampler self test, int16 to float differs from plain c");
+    ok = false;
+  }
+
+  //sse2 rounds halves to even, so one step off is fine
+  std::vector<int16_t> out16(samples);
+  FloatToInt16(&inFloat[0], &out16[0], samples);
+  for (int i = 0; i < samples; i++)
+  {
+    if (abs(out16[i] - refFloatToInt16(inFloat[i])) > 1)
+    {
+      CLog::Log(LOGERROR, "Spotifylog: resampler self test, float to int16 differs from plain c at %i, %f gave %i", i, inFloat[i], (int)out16[i]);
+      ok = false;
+      break;
+    }
+  }
+
+  for (int channels = 1; channels <= 2; channels++)
+  {
+    int size = (samples / channels) * channels;
+    float sum[2], refSum[2] = { 0.0f, 0.0f };
+    DotProduct(&taps[0], &inFloat[0], size, channels, sum);
+    double refSumD[2] = { 0.0, 0.0 };
+    for (int i = 0; i < size; i++)
+      refSumD[i % channels] += (double)taps[i] * inFloat[i];
+    for (int c = 0; c < channels; c++)
+    {
+      refSum[c] = (float)refSumD[c];
+      if (fabs(sum[c] - refSum[c]) > 1e-3)
+      {
+        CLog::Log(LOGERROR, "Spotifylog: resampler self test, %i channel dot product is %f, plain c gives %f", channels, sum[c], refSum[c]);
+        ok = false;
+      }
+    }
+  }
+
+  //a 1 kHz sine through 44100 -> 48000 stereo, in deliveries of odd sizes like libspotify gives us
+  const double frequency = 1000.0;
+  const double amplitude = 0.5;
+  const int inFrames = 44100;
+  SpotifyResampler resampler;
+  if (!resampler.SetFormat(44100, 2, 48000, 2))
+    return false;
+  std::vector<int16_t> sine(inFrames * 2);
+  for (int i = 0; i < inFrames; i++)
+    sine[2 * i] = sine[2 * i + 1] = (int16_t)floor(amplitude * 32767.0 * sin(2.0 * M_PI * frequency * i / 44100.0) + 0.5);
+  std::vector<int16_t> resampled;
+  for (int pos = 0; pos < inFrames; )
+  {
+    int frames = inFrames - pos < 997 ? inFrames - pos : 997;
+    const int16_t *out;
+    int outFrames = resampler.Process(&sine[pos * 2], frames, &out);
+    resampled.insert(resampled.end(), out, out + outFrames * 2);
+    pos += frames;
+  }
+
+  int outFrames = resampled.size() / 2;
+  if (abs(outFrames - 48000) > 2)
+  {
+    CLog::Log(LOGERROR, "Spotifylog: resampler self test, one second at 44100 gave %i frames at 48000", outFrames);
+    ok = false;
+  }
+
+  //fit a 1 kHz sine to the left channel past the filter's start, what is left over is noise and distortion
+  int first = SPOTIFY_RESAMPLER_TAPS * 2;
+  double ss = 0.0, sc = 0.0, cc = 0.0, ys = 0.0, yc = 0.0;
+  for (int i = first; i < outFrames; i++)
+  {
+    double w = 2.0 * M_PI * frequency * i / 48000.0;
+    double s = sin(w), co = cos(w), y = resampled[2 * i] / 32768.0;
+    ss += s * s; sc += s * co; cc += co * co; ys += y * s; yc += y * co;
+  }
+  double det = ss * cc - sc * sc;
+  double a = (ys * cc - yc * sc) / det;
+  double b = (yc * ss - ys * sc) / det;
+  double signal = 0.0, noise = 0.0;
+  for (int i = first; i < outFrames; i++)
+  {
+    double w = 2.0 * M_PI * frequency * i / 48000.0;
+    double fit = a * sin(w) + b * cos(w);
+    double y = resampled[2 * i] / 32768.0;
+    signal += fit * fit;
+    noise += (y - fit) * (y - fit);
+    if (resampled[2 * i] != resampled[2 * i + 1])
+      noise += 1.0;
+  }
+  double gain = sqrt(a * a + b * b) / amplitude;
+  double snr = noise > 0.0 ? 10.0 * log10(signal / noise) : 200.0;
+  if (snr < 60.0 || fabs(20.0 * log10(gain)) > 0.5)
+  {
+    CLog::Log(LOGERROR, "Spotifylog: resampler self test, 1 kHz at 44100 -> 48000 has gain %.2f dB and snr %.1f dB", 20.0 * log10(gain), snr);
+    ok = false;
+  }
+
+#ifdef SPOTIFY_HAS_SSE2
+  const char *kernels = "sse2";
+#else
+  const char *kernels = "plain c";
+#endif
+  CLog::Log(ok ? LOGNOTICE : LOGERROR, "Spotifylog: resampler self test %s, %s kernels, 1 kHz at 44100 -> 48000 has gain %.2f dB and snr %.1f dB",
+            ok ? "passed" : "failed", kernels, 20.0 * log10(gain), snr);
+  return ok;
+}
@@ -0,0 +1,87 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SPOTIFY_HAS_SSE2
+#endif
+
+//filter taps per polyphase branch, keep it a multiple of 4 for the simd dot product
+#define SPOTIFY_RESAMPLER_TAPS 16
+//we do not build filter banks bigger than this, 44100 <-> 48000 needs 147
+#define SPOTIFY_RESAMPLER_MAX_PHASES 1024
+
+//converts what libspotify delivers to the format the codec told paplayer about
+//mono is upmixed to stereo and other sample rates go through a polyphase resampler
+//only used from the music delivery thread and under the codec's player lock
+class SpotifyResampler
+{
+public:
+  SpotifyResampler();
+  ~SpotifyResampler();
+
+  //only rebuilds the filter when the format changes, returns false if we cant convert it
+  bool SetFormat(int inRate, int inChannels, int outRate, int outChannels);
+  bool IsPassthrough(){ return !m_isSupported || (m_inRate == m_outRate && m_inChannels == m_outChannels); }
+  void Reset();
+
+  //the most input frames we may pass to Process without getting more than outFrames back
+  int GetInputFrames(int outFrames);
+  //returns the number of frames in out, the pointer is valid until the next call
+  int Process(const int16_t *in, int frames, const int16_t **out);
+
+  //the kernels, simd when the compiler gives us sse2
+  static void MonoToStereo(const int16_t *in, int16_t *out, int frames);
+  static void Int16ToFloat(const int16_t *in, float *out, int samples);
+  static void FloatToInt16(const float *in, int16_t *out, int samples);
+  //sums a[k] * b[k] into out[k % channels], for one or two interleaved channels
+  static void DotProduct(const float *a, const float *b, int size, int channels, float *out);
+
+  //checks the kernels against plain c and a sine through 44100 -> 48000, logs what it finds
+  static bool SelfTest();
+
+private:
+  void buildFilter();
+  int resample(const int16_t *in, int frames);
+
+  int m_inRate;
+  int m_inChannels;
+  int m_outRate;
+  int m_outChannels;
+  bool m_isSupported;
+
+  //output rate / input rate = m_up / m_down
+  int m_up;
+  int m_down;
+  int m_phase;
+  int m_inputPos;
+
+  //one branch per phase, each tap repeated per channel so we can run it on the interleaved history
+  std::vector<float> m_filter;
+  std::vector<float> m_history;
+  std::vector<float> m_resampled;
+  std::vector<int16_t> m_output;
+  std::vector<int16_t> m_upmix;
+};
@@ -0,0 +1,144 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+#include "spotifyRingBuffer.h"
+#include "utils/Atomics.h"
+#include <string.h>
+
+SpotifyRingBuffer::SpotifyRingBuffer()
+{
+  m_buffer = 0;
+  m_size = 0;
+  m_mask = 0;
+  m_writePos = 0;
+  m_readPos = 0;
+}
+
+SpotifyRingBuffer::~SpotifyRingBuffer()
+{
+  Destroy();
+}
+
+bool SpotifyRingBuffer::Create(unsigned int size)
+{
+  unsigned int newSize = 1;
+  while (newSize < size)
+    newSize <<= 1;
+
+  if (newSize != m_size)
+  {
+    Destroy();
+    m_buffer = new char[newSize];
+    if (!m_buffer)
+      return false;
+    m_size = newSize;
+    m_mask = newSize - 1;
+  }
+  m_writePos = 0;
+  m_readPos = 0;
+  return true;
+}
+
+void SpotifyRingBuffer::Destroy()
+{
+  delete [] m_buffer;
+  m_buffer = 0;
+  m_size = 0;
+  m_mask = 0;
+  m_writePos = 0;
+  m_readPos = 0;
+}
+
+//the positions only ever grow, the difference between them is the fill level
+//reading them with an atomic add gives us the barrier we need on all platforms
+long SpotifyRingBuffer::loadPos(volatile long *pos)
+{
+  return AtomicAdd(pos, 0);
+}
+
+unsigned int SpotifyRingBuffer::GetReadSize()
+{
+  return (unsigned long)loadPos(&m_writePos) - (unsigned long)loadPos(&m_readPos);
+}
+
+unsigned int SpotifyRingBuffer::GetWriteSize()
+{
+  return m_size - GetReadSize();
+}
+
+unsigned int SpotifyRingBuffer::Write(const void *data, unsigned int size)
+{
+  if (!m_buffer)
+    return 0;
+
+  unsigned long writePos = m_writePos;
+  unsigned int space = m_size - ((unsigned long)writePos - (unsigned long)loadPos(&m_readPos));
+  if (size > space)
+    size = space;
+  if (size == 0)
+    return 0;
+
+  //copy up to the end of the buffer and wrap around if needed
+  unsigned int start = writePos & m_mask;
+  unsigned int first = m_size - start;
+  if (first > size)
+    first = size;
+  memcpy(m_buffer + start, data, first);
+  if (size > first)
+    memcpy(m_buffer, (const char*)data + first, size - first);
+
+  //publish the new data to the consumer
+  AtomicAdd(&m_writePos, size);
+  return size;
+}
+
+unsigned int SpotifyRingBuffer::Read(void *data, unsigned int size)
+{
+  if (!m_buffer)
+    return 0;
+
+  unsigned long readPos = m_readPos;
+  unsigned int available = (unsigned long)loadPos(&m_writePos) - readPos;
+  if (size > available)
+    size = available;
+  if (size == 0)
+    return 0;
+
+  unsigned int start = readPos & m_mask;
+  unsigned int first = m_size - start;
+  if (first > size)
+    first = size;
+  memcpy(data, m_buffer + start, first);
+  if (size > first)
+    memcpy((char*)data + first, m_buffer, size - first);
+
+  //give the space back to the producer
+  AtomicAdd(&m_readPos, size);
+  return size;
+}
+
+void SpotifyRingBuffer::Clear()
+{
+  //skip everything the producer has written so far
+  unsigned int available = GetReadSize();
+  if (available)
+    AtomicAdd(&m_readPos, available);
+}
@@ -0,0 +1,64 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+#pragma once
+
+#define SPOTIFY_CACHE_LINE 64
+
+//a lock free single producer, single consumer ring buffer
+//libspotify writes to it from its music delivery thread and paplayer reads from it
+//the write position is only moved by the producer and the read position only by the consumer
+class SpotifyRingBuffer
+{
+public:
+  SpotifyRingBuffer();
+  ~SpotifyRingBuffer();
+
+  //the size is rounded up to the next power of two, not thread safe
+  bool Create(unsigned int size);
+  void Destroy();
+  unsigned int GetSize(){ return m_size; }
+
+  //can be called from both sides
+  unsigned int GetReadSize();
+  unsigned int GetWriteSize();
+
+  //producer side
+  unsigned int Write(const void *data, unsigned int size);
+
+  //consumer side
+  unsigned int Read(void *data, unsigned int size);
+  void Clear();
+
+private:
+  long loadPos(volatile long *pos);
+
+  char *m_buffer;
+  unsigned int m_size;
+  unsigned int m_mask;
+
+  //keep the positions on their own cache lines so the two threads dont fight over them
+  char m_pad0[SPOTIFY_CACHE_LINE];
+  volatile long m_writePos;
+  char m_pad1[SPOTIFY_CACHE_LINE - sizeof(long)];
+  volatile long m_readPos;
+  char m_pad2[SPOTIFY_CACHE_LINE - sizeof(long)];
+};
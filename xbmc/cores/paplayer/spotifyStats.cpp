@@ -0,0 +1,188 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+#include "spotifyStats.h"
+#include "AdvancedSettings.h"
+#include "FileSystem/File.h"
+#include "Util.h"
+#include "utils/Atomics.h"
+#include "utils/SingleLock.h"
+#include "utils/log.h"
+
+using namespace XFILE;
+
+static const int fillBounds[] = { 0, 10, 25, 50, 75, 90, 100 };
+static const int jitterBounds[] = { 1, 2, 5, 10, 20, 50, 100, 200, 500 };
+static const int rebufferBounds[] = { 50, 100, 250, 500, 1000, 2000, 5000, 10000 };
+static const int latencyBounds[] = { 100, 250, 500, 1000, 2000, 3000, 5000, 10000 };
+
+#define BOUNDS(x) x, sizeof(x) / sizeof(x[0])
+
+volatile long SpotifyStats::m_deliveries = 0;
+int64_t SpotifyStats::m_deliveredFrames = 0;
+int64_t SpotifyStats::m_rejectedFrames = 0;
+CCriticalSection SpotifyStats::m_framesLock;
+volatile long SpotifyStats::m_fullDeliveries = 0;
+volatile long SpotifyStats::m_reads = 0;
+volatile long SpotifyStats::m_underruns = 0;
+
+SpotifyStatsHistogram SpotifyStats::m_fill("buffer fill on read", "%", BOUNDS(fillBounds));
+SpotifyStatsHistogram SpotifyStats::m_jitter("delivery jitter", "ms", BOUNDS(jitterBounds));
+SpotifyStatsHistogram SpotifyStats::m_rebufferTime("rebuffer time", "ms", BOUNDS(rebufferBounds));
+SpotifyStatsHistogram SpotifyStats::m_startLatency("init to first sample", "ms", BOUNDS(latencyBounds));
+
+SpotifyStatsHistogram::SpotifyStatsHistogram(const char *name, const char *unit, const int *bounds, int count)
+{
+  m_name = name;
+  m_unit = unit;
+  m_bounds = bounds;
+  m_count = count < SPOTIFY_STATS_MAX_BUCKETS ? count : SPOTIFY_STATS_MAX_BUCKETS;
+  Reset();
+}
+
+void SpotifyStatsHistogram::Add(int value)
+{
+  int bucket = 0;
+  while (bucket < m_count && value > m_bounds[bucket])
+    bucket++;
+  AtomicAdd(&m_buckets[bucket], 1);
+  AtomicAdd(&m_samples, 1);
+  {
+    CSingleLock lock(m_sumLock);
+    m_sum += value;
+  }
+  //a lost update here only makes the max a little off
+  if (value > m_max)
+    m_max = value;
+}
+
+void SpotifyStatsHistogram::Reset()
+{
+  for (int i = 0; i <= SPOTIFY_STATS_MAX_BUCKETS; i++)
+    m_buckets[i] = 0;
+  m_samples = 0;
+  {
+    CSingleLock lock(m_sumLock);
+    m_sum = 0;
+  }
+  m_max = 0;
+}
+
+void SpotifyStatsHistogram::Format(CStdString &out)
+{
+  long samples = m_samples;
+  int64_t sum;
+  {
+    CSingleLock lock(m_sumLock);
+    sum = m_sum;
+  }
+  CStdString line;
+  line.Format("%s: %ld samples, avg %ld %s, max %ld %s\n", m_name, samples, samples ? (long)(sum / samples) : 0, m_unit, (long)m_max, m_unit);
+  out += line;
+  if (samples == 0)
+    return;
+
+  for (int i = 0; i <= m_count; i++)
+  {
+    if (i < m_count)
+      line.Format("  <= %5i %-2s %8ld\n", m_bounds[i], m_unit, (long)m_buckets[i]);
+    else
+      line.Format("   > %5i %-2s %8ld\n", m_bounds[m_count - 1], m_unit, (long)m_buckets[i]);
+    out += line;
+  }
+}
+
+void SpotifyStats::AddDelivery(int frames, int accepted)
+{
+  AtomicAdd(&m_deliveries, 1);
+  {
+    CSingleLock lock(m_framesLock);
+    m_deliveredFrames += accepted;
+    if (accepted < frames)
+      m_rejectedFrames += frames - accepted;
+  }
+  if (accepted == 0 && frames > 0)
+    AtomicAdd(&m_fullDeliveries, 1);
+}
+
+void SpotifyStats::AddRead(int fillPercent)
+{
+  AtomicAdd(&m_reads, 1);
+  m_fill.Add(fillPercent);
+}
+
+void SpotifyStats::AddUnderrun()
+{
+  AtomicAdd(&m_underruns, 1);
+}
+
+void SpotifyStats::Dump(bool reset)
+{
+  int64_t deliveredFrames;
+  int64_t rejectedFrames;
+  {
+    CSingleLock lock(m_framesLock);
+    deliveredFrames = m_deliveredFrames;
+    rejectedFrames = m_rejectedFrames;
+  }
+  CStdString out;
+  CStdString line;
+  line.Format("deliveries: %ld, frames accepted: %lld, frames rejected: %lld, deliveries rejected: %ld\n",
+              (long)m_deliveries, (long long)deliveredFrames, (long long)rejectedFrames, (long)m_fullDeliveries);
+  out += line;
+  line.Format("reads: %ld, underruns: %ld\n", (long)m_reads, (long)m_underruns);
+  out += line;
+  m_fill.Format(out);
+  m_jitter.Format(out);
+  m_rebufferTime.Format(out);
+  m_startLatency.Format(out);
+
+  CLog::Log(LOGNOTICE, "Spotifylog: playback stats\n%s", out.c_str());
+
+  CFile file;
+  if (file.OpenForWrite(CUtil::AddFileToFolder(g_advancedSettings.m_spotifyCacheFolder, "playbackstats.txt"), true))
+  {
+    file.Write(out.c_str(), out.size());
+    file.Close();
+  }
+  else
+    CLog::Log(LOGERROR, "Spotifylog: could not write the playback stats");
+
+  if (reset)
+    Reset();
+}
+
+void SpotifyStats::Reset()
+{
+  m_deliveries = 0;
+  {
+    CSingleLock lock(m_framesLock);
+    m_deliveredFrames = 0;
+    m_rejectedFrames = 0;
+  }
+  m_fullDeliveries = 0;
+  m_reads = 0;
+  m_underruns = 0;
+  m_fill.Reset();
+  m_jitter.Reset();
+  m_rebufferTime.Reset();
+  m_startLatency.Reset();
+}
@@ -0,0 +1,84 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+#pragma once
+
+#include "StdString.h"
+#include "utils/CriticalSection.h"
+#include <stdint.h>
+
+#define SPOTIFY_STATS_MAX_BUCKETS 12
+
+//a histogram that can be filled from any thread, the buckets without locks
+//the sum is 64 bit so it does not wrap on a long session, there are no 64 bit atomics so it has a short lock
+//value goes into the first bucket whose bound is >= value, the last bucket takes the rest
+class SpotifyStatsHistogram
+{
+public:
+  SpotifyStatsHistogram(const char *name, const char *unit, const int *bounds, int count);
+
+  void Add(int value);
+  void Reset();
+  void Format(CStdString &out);
+
+private:
+  const char *m_name;
+  const char *m_unit;
+  const int *m_bounds;
+  int m_count;
+  volatile long m_buckets[SPOTIFY_STATS_MAX_BUCKETS + 1];
+  volatile long m_samples;
+  int64_t m_sum;
+  CCriticalSection m_sumLock;
+  volatile long m_max;
+};
+
+//counters for the spotify playback path, cheap enough to update on every delivery and read
+//nothing is logged until someone asks for a dump
+class SpotifyStats
+{
+public:
+  static void AddDelivery(int frames, int accepted);
+  static void AddRead(int fillPercent);
+  static void AddUnderrun();
+  static void AddJitter(int ms){ m_jitter.Add(ms); }
+  static void AddRebufferTime(int ms){ m_rebufferTime.Add(ms); }
+  static void AddStartLatency(int ms){ m_startLatency.Add(ms); }
+
+  //writes everything to the log and to playbackstats.txt in the cache folder, and starts counting again if reset is set
+  static void Dump(bool reset = false);
+  static void Reset();
+
+private:
+  static volatile long m_deliveries;
+  //frames wrap a 32 bit long after half a day of playback, they are 64 bit under m_framesLock
+  static int64_t m_deliveredFrames;
+  static int64_t m_rejectedFrames;
+  static CCriticalSection m_framesLock;
+  static volatile long m_fullDeliveries;
+  static volatile long m_reads;
+  static volatile long m_underruns;
+
+  static SpotifyStatsHistogram m_fill;
+  static SpotifyStatsHistogram m_jitter;
+  static SpotifyStatsHistogram m_rebufferTime;
+  static SpotifyStatsHistogram m_startLatency;
+};
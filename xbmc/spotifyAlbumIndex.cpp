@@ -0,0 +1,158 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+
+#include "spotifyAlbumIndex.h"
+#include "MusicDatabase.h"
+#include "utils/SingleLock.h"
+#include "utils/TimeUtils.h"
+#include "utils/log.h"
+
+using namespace std;
+
+//read it again now and then anyway, not every change to the library tells us
+#define ALBUMINDEX_MAX_AGE (10 * 60 * 1000)
+
+SpotifyAlbumIndex::SpotifyAlbumIndex()
+{
+  m_builder = 0;
+  m_isWanted = false;
+  m_generation = 1;
+  m_builtGeneration = 0;
+  m_buildTime = 0;
+}
+
+SpotifyAlbumIndex::~SpotifyAlbumIndex()
+{
+  Stop();
+}
+
+void SpotifyAlbumIndex::Start()
+{
+  if (m_builder)
+    return;
+  m_isWanted = true;
+  m_builder = new Builder(*this);
+  m_builder->Create();
+  m_buildEvent.Set();
+}
+
+void SpotifyAlbumIndex::Stop()
+{
+  if (!m_builder)
+    return;
+  m_buildEvent.Set();
+  m_builder->StopThread();
+  delete m_builder;
+  m_builder = 0;
+}
+
+CStdString SpotifyAlbumIndex::getKey(CStdString album, CStdString artist)
+{
+  //the database compares the names with like, so case does not matter
+  album.ToLower();
+  artist.ToLower();
+  return album + "\n" + artist;
+}
+
+void SpotifyAlbumIndex::build()
+{
+  unsigned int start = CTimeUtils::GetTimeMS();
+  //an invalidate that comes while we read the database makes us read it again
+  long generation = m_generation;
+
+  EntryMap entries;
+  CMusicDatabase musicdatabase;
+  if (musicdatabase.Open())
+  {
+    VECALBUMS albums;
+    vector<CStdString> thumbs;
+    musicdatabase.GetAlbumsForIndex(albums, thumbs);
+    musicdatabase.Close();
+
+    for (unsigned int i = 0; i < albums.size(); i++)
+    {
+      Entry &entry = entries[getKey(albums[i].strAlbum, albums[i].strArtist)];
+      entry.album = albums[i];
+      entry.thumb = i < thumbs.size() ? thumbs[i] : "";
+    }
+  }
+
+  CSingleLock lock(m_lock);
+  m_entries.swap(entries);
+  m_builtGeneration = generation;
+  m_buildTime = start;
+  m_isWanted = false;
+  checkAge();
+  CLog::Log(LOGDEBUG, "Spotifylog: album index built with %u albums in %u ms", (unsigned int)m_entries.size(), CTimeUtils::GetTimeMS() - start);
+}
+
+void SpotifyAlbumIndex::Builder::Process()
+{
+  while (!m_bStop)
+  {
+    m_index.m_buildEvent.WaitMSec(1000);
+    if (!m_bStop && m_index.m_isWanted)
+      m_index.build();
+  }
+}
+
+void SpotifyAlbumIndex::checkAge()
+{
+  if (m_builtGeneration != m_generation || CTimeUtils::GetTimeMS() - m_buildTime > ALBUMINDEX_MAX_AGE)
+  {
+    if (!m_isWanted)
+    {
+      m_isWanted = true;
+      m_buildEvent.Set();
+    }
+  }
+}
+
+bool SpotifyAlbumIndex::IsReady()
+{
+  CSingleLock lock(m_lock);
+  checkAge();
+  return m_builtGeneration == m_generation;
+}
+
+CFileItemPtr SpotifyAlbumIndex::Find(const CStdString &album, const CStdString &artist)
+{
+  CSingleLock lock(m_lock);
+  //an old index is still used while the new one is read, one from before a change is not
+  checkAge();
+  if (m_builtGeneration != m_generation)
+    return CFileItemPtr();
+
+  EntryMap::iterator it = m_entries.find(getKey(album, artist));
+  if (it == m_entries.end())
+    return CFileItemPtr();
+
+  Entry &entry = it->second;
+  CStdString path;
+  path.Format("musicdb://3/%ld/", entry.album.idAlbum);
+  CFileItemPtr pItem(new CFileItem(path, entry.album));
+  if (!entry.thumb.IsEmpty() && entry.thumb != "NONE")
+    pItem->SetThumbnailImage(entry.thumb);
+  else
+    pItem->SetThumbnailImage("DefaultMusicAlbums.png");
+  return pItem;
+}
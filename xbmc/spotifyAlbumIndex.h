@@ -0,0 +1,86 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+
+#pragma once
+
+#include "StdString.h"
+#include "FileItem.h"
+#include "Album.h"
+#include "utils/Thread.h"
+#include "utils/Event.h"
+#include "utils/CriticalSection.h"
+#include <map>
+
+//the albums in the library by name and album artist, so spotify results can be matched against it without asking the database for every album
+//it is read with one query on a thread of its own and swapped in when it is done, the callbacks never wait for the database
+class SpotifyAlbumIndex
+{
+public:
+  SpotifyAlbumIndex();
+  ~SpotifyAlbumIndex();
+
+  //starts the thread and reads the library the first time
+  void Start();
+  void Stop();
+
+  //returns the library item of the album, or an empty pointer if it is not in the library
+  //while the library is being read again after a change it does not know, and returns an empty pointer too
+  CFileItemPtr Find(const CStdString &album, const CStdString &artist);
+  //false while the library is being read again after a change
+  bool IsReady();
+  //can be called from any thread, the index is read again the next time it is used
+  void Invalidate(){ m_generation++; }
+
+private:
+  struct Entry
+  {
+    CAlbum album;
+    CStdString thumb;
+  };
+  typedef std::map<CStdString, Entry> EntryMap;
+
+  class Builder : public CThread
+  {
+  public:
+    Builder(SpotifyAlbumIndex &index) : m_index(index) {}
+  protected:
+    virtual void Process();
+  private:
+    SpotifyAlbumIndex &m_index;
+  };
+
+  static CStdString getKey(CStdString album, CStdString artist);
+  //on the builder thread
+  void build();
+  //asks the builder for a new index if this one is old or the library has changed, with m_lock held
+  void checkAge();
+
+  EntryMap m_entries;
+  CCriticalSection m_lock;
+  CEvent m_buildEvent;
+  Builder *m_builder;
+  volatile bool m_isWanted;
+  //bumped by Invalidate, the index is good while it was built from the current one
+  volatile long m_generation;
+  long m_builtGeneration;
+  unsigned int m_buildTime;
+};
@@ -0,0 +1,226 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+
+#include "spotifyImport.h"
+#include "spotinterface.h"
+#include "MusicDatabase.h"
+#include "Picture.h"
+#include "GUIWindowManager.h"
+#include "GUIUserMessages.h"
+#include "Application.h"
+#include "GUIDialogProgress.h"
+#include "Util.h"
+#include "utils/TimeUtils.h"
+#include "utils/log.h"
+
+using namespace std;
+
+//how many albums we browse at the same time, spotify answers them in parallel
+#define IMPORT_MAX_BROWSES 8
+
+SpotifyImport::SpotifyImport(const CStdString &name)
+{
+  m_name = name;
+  m_session = 0;
+  m_next = 0;
+  m_browsing = 0;
+  m_browsed = 0;
+  m_startTime = 0;
+  m_isWriting = false;
+  m_isDone = false;
+}
+
+SpotifyImport::~SpotifyImport()
+{
+  StopThread();
+  //the session lock is held by the one deleting us
+  for (unsigned int i = 0; i < m_albums.size(); i++)
+  {
+    if (m_albums[i].browse)
+      sp_albumbrowse_release(m_albums[i].browse);
+    sp_album_release(m_albums[i].album);
+  }
+}
+
+void SpotifyImport::AddAlbum(sp_album *spAlbum)
+{
+  for (unsigned int i = 0; i < m_albums.size(); i++)
+  {
+    if (m_albums[i].album == spAlbum)
+      return;
+  }
+  ImportAlbum album;
+  album.album = spAlbum;
+  album.browse = 0;
+  album.isBrowsed = false;
+  sp_album_add_ref(spAlbum);
+  m_albums.push_back(album);
+}
+
+void SpotifyImport::Start(sp_session *session)
+{
+  CLog::Log(LOGNOTICE, "Spotifylog: adding %i albums from %s to the library", (int)m_albums.size(), m_name.c_str());
+  m_session = session;
+  m_startTime = CTimeUtils::GetTimeMS();
+  CStdString message;
+  message.Format("Adding %i albums from %s", (int)m_albums.size(), m_name.c_str());
+  g_spotifyInterface->showProgressDialog(message);
+  browseNext();
+}
+
+void SpotifyImport::browseNext()
+{
+  while (m_browsing < IMPORT_MAX_BROWSES && m_next < m_albums.size())
+  {
+    ImportAlbum &album = m_albums[m_next++];
+    album.browse = sp_albumbrowse_create(m_session, album.album, &cb_albumBrowseComplete, this);
+    if (album.browse)
+      m_browsing++;
+    else
+    {
+      album.isBrowsed = true;
+      m_browsed++;
+    }
+  }
+
+  //everything is here, write it
+  if (m_browsing == 0 && m_next >= m_albums.size() && !m_isWriting)
+  {
+    m_isWriting = true;
+    Create();
+  }
+}
+
+void SpotifyImport::cb_albumBrowseComplete(sp_albumbrowse *result, void *userdata)
+{
+  SpotifyImport *import = (SpotifyImport*)userdata;
+  import->albumBrowsed(result);
+}
+
+void SpotifyImport::albumBrowsed(sp_albumbrowse *result)
+{
+  ImportAlbum *album = 0;
+  for (unsigned int i = 0; i < m_albums.size(); i++)
+  {
+    if (m_albums[i].browse == result)
+      album = &m_albums[i];
+  }
+  if (!album)
+    return;
+
+  if (SP_ERROR_OK == sp_albumbrowse_error(result))
+  {
+    sp_album *spAlbum = album->album;
+    album->info.strAlbum = sp_album_name(spAlbum);
+    album->info.strArtist = sp_artist_name(sp_album_artist(spAlbum));
+    album->info.iYear = sp_album_year(spAlbum);
+    album->info.strType = "spotifyalbum";
+    for (int index = 0; index < sp_albumbrowse_num_tracks(result); index++)
+    {
+      sp_track *spTrack = sp_albumbrowse_track(result, index);
+      if (!sp_track_is_available(spTrack))
+        continue;
+      CSong song;
+      g_spotifyInterface->spTrackToSong(spTrack, song);
+      //the AddSong function seems to crash if you dont provide it with a path before the filename
+      song.strFileName = "/home/" + song.strFileName;
+      album->songs.push_back(song);
+    }
+    album->thumb = g_spotifyInterface->getAlbumThumb(spAlbum);
+  }
+  else
+    CLog::Log(LOGERROR, "Spotifylog: could not browse %s for the import", sp_album_name(album->album));
+
+  //we have what we need, dont keep the tracks around
+  sp_albumbrowse_release(result);
+  album->browse = 0;
+  album->isBrowsed = true;
+  m_browsing--;
+  m_browsed++;
+  updateProgress(m_browsed * 80 / m_albums.size());
+  browseNext();
+}
+
+void SpotifyImport::updateProgress(int percentage)
+{
+  g_spotifyInterface->setProgress(percentage);
+}
+
+void SpotifyImport::Process()
+{
+  unsigned int browseTime = CTimeUtils::GetTimeMS() - m_startTime;
+  unsigned int start = CTimeUtils::GetTimeMS();
+  int numAlbums = 0;
+  int numSongs = 0;
+
+  CMusicDatabase db;
+  if (db.Open())
+  {
+    //one transaction for all of it, the database does not have to sync after every song
+    db.BeginTransaction();
+    for (unsigned int i = 0; i < m_albums.size() && !m_bStop; i++)
+    {
+      ImportAlbum &album = m_albums[i];
+      if (album.songs.empty())
+        continue;
+      for (unsigned int j = 0; j < album.songs.size(); j++)
+        db.AddSong(album.songs[j], false);
+      numSongs += album.songs.size();
+
+      int albumId = db.GetAlbumByName(album.info.strAlbum, album.info.strArtist);
+      if (albumId != -1)
+      {
+        //we know everything about it already, no need to read it back
+        db.SetAlbumInfo(albumId, album.info, album.songs, false);
+        if (!album.thumb.IsEmpty())
+        {
+          CStdString thumb = CUtil::GetCachedAlbumThumb(album.info.strAlbum, album.info.strArtist);
+          CPicture::CacheThumb(album.thumb, thumb);
+          db.SaveAlbumThumb(albumId, thumb);
+        }
+        numAlbums++;
+      }
+      if ((i & 7) == 7)
+        updateProgress(80 + i * 19 / m_albums.size());
+    }
+    db.CommitTransaction();
+    db.Close();
+  }
+
+  unsigned int writeTime = CTimeUtils::GetTimeMS() - start;
+  float seconds = (browseTime + writeTime) / 1000.0f;
+  CLog::Log(LOGNOTICE, "Spotifylog: added %i albums and %i songs from %s in %.1f s (browsing %u ms, writing %u ms, %.0f songs/s)",
+            numAlbums, numSongs, m_name.c_str(), seconds, browseTime, writeTime, seconds > 0 ? numSongs / seconds : 0.0f);
+
+  g_spotifyInterface->invalidateAlbumIndex();
+  g_spotifyInterface->hideProgressDialog();
+
+  //a notification, a modal dialog would keep this thread alive until the user closes it
+  CStdString line;
+  line.Format("Added %i albums, %i songs in %.1f s (%.0f songs/s)", numAlbums, numSongs, seconds, seconds > 0 ? numSongs / seconds : 0.0f);
+  g_application.m_guiDialogKaiToast.QueueNotification("Spotify", line);
+
+  CGUIMessage message(GUI_MSG_NOTIFY_ALL, 0, 0, GUI_MSG_UPDATE_PATH);
+  message.SetStringParam("musicdb://");
+  g_windowManager.SendThreadMessage(message);
+  m_isDone = true;
+}
@@ -0,0 +1,84 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+
+#pragma once
+
+#ifndef SP_CALLCONV
+#ifdef _WIN32
+#define SP_CALLCONV __stdcall
+#else
+#define SP_CALLCONV
+#endif
+#endif
+
+#include <spotify/api.h>
+#include <vector>
+#include "utils/Thread.h"
+#include "Album.h"
+#include "Song.h"
+
+//adds a lot of albums to the library in one go, a discography or the albums of a playlist
+//the albums are browsed a few at a time on the session thread, then all of them are written in one transaction on our own thread
+class SpotifyImport : public CThread
+{
+public:
+  SpotifyImport(const CStdString &name);
+  virtual ~SpotifyImport();
+
+  //only before Start, the albums already in the library are skipped
+  void AddAlbum(sp_album *spAlbum);
+  int GetNumAlbums(){ return m_albums.size(); }
+
+  //call with the session lock held
+  void Start(sp_session *session);
+  bool IsDone(){ return m_isDone; }
+
+  static void SP_CALLCONV cb_albumBrowseComplete(sp_albumbrowse *result, void *userdata);
+
+protected:
+  virtual void Process();
+
+private:
+  struct ImportAlbum
+  {
+    sp_album *album;
+    sp_albumbrowse *browse;
+    bool isBrowsed;
+    CAlbum info;
+    VECSONGS songs;
+    CStdString thumb;
+  };
+
+  void browseNext();
+  void albumBrowsed(sp_albumbrowse *result);
+  void updateProgress(int percentage);
+
+  CStdString m_name;
+  sp_session *m_session;
+  std::vector<ImportAlbum> m_albums;
+  unsigned int m_next;
+  int m_browsing;
+  int m_browsed;
+  unsigned int m_startTime;
+  bool m_isWriting;
+  volatile bool m_isDone;
+};
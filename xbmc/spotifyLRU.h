@@ -0,0 +1,119 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+#pragma once
+
+#include <list>
+#include <map>
+#include <utility>
+#include <boost/shared_ptr.hpp>
+
+//a least recently used cache with a limit on both the number of entries and their total cost
+//the value type has to have a size_t GetCost() that estimates the memory it holds
+//it is not thread safe, the spotify caches are only touched with the session lock held
+template <class Key, class Value>
+class SpotifyLRU
+{
+public:
+  typedef boost::shared_ptr<Value> ValuePtr;
+  typedef std::pair<Key, ValuePtr> Entry;
+  typedef typename std::list<Entry>::iterator iterator;
+
+  SpotifyLRU(unsigned int maxEntries = 10, size_t maxCost = 4 * 1024 * 1024)
+    : m_maxEntries(maxEntries), m_maxCost(maxCost) {}
+
+  void SetLimits(unsigned int maxEntries, size_t maxCost)
+  {
+    m_maxEntries = maxEntries;
+    m_maxCost = maxCost;
+    Trim();
+  }
+
+  //returns an empty pointer if we dont have it, a hit makes it the most recently used
+  ValuePtr Get(const Key &key)
+  {
+    typename std::map<Key, iterator>::iterator it = m_index.find(key);
+    if (it == m_index.end())
+      return ValuePtr();
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    return it->second->second;
+  }
+
+  ValuePtr Peek(const Key &key)
+  {
+    typename std::map<Key, iterator>::iterator it = m_index.find(key);
+    return it == m_index.end() ? ValuePtr() : it->second->second;
+  }
+
+  void Put(const Key &key, ValuePtr value)
+  {
+    Remove(key);
+    m_entries.push_front(Entry(key, value));
+    m_index[key] = m_entries.begin();
+    Trim();
+  }
+
+  void Remove(const Key &key)
+  {
+    typename std::map<Key, iterator>::iterator it = m_index.find(key);
+    if (it == m_index.end())
+      return;
+    m_entries.erase(it->second);
+    m_index.erase(it);
+  }
+
+  void Clear()
+  {
+    m_entries.clear();
+    m_index.clear();
+  }
+
+  //drops the least recently used entries until we are within the limits, the newest always stays
+  //call it when an entry has grown, e.g. when its browse result has arrived
+  void Trim()
+  {
+    size_t cost = GetCost();
+    while (m_entries.size() > 1 && (m_entries.size() > m_maxEntries || cost > m_maxCost))
+    {
+      cost -= m_entries.back().second->GetCost();
+      m_index.erase(m_entries.back().first);
+      m_entries.pop_back();
+    }
+  }
+
+  size_t GetCost()
+  {
+    size_t cost = 0;
+    for (iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+      cost += it->second->GetCost();
+    return cost;
+  }
+
+  unsigned int Size(){ return m_entries.size(); }
+  iterator Begin(){ return m_entries.begin(); }
+  iterator End(){ return m_entries.end(); }
+
+private:
+  std::list<Entry> m_entries;
+  std::map<Key, iterator> m_index;
+  unsigned int m_maxEntries;
+  size_t m_maxCost;
+};
@@ -0,0 +1,195 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+#include "spotifySession.h"
+#include "spotinterface.h"
+#include "utils/SingleLock.h"
+#include "utils/log.h"
+
+using namespace std;
+
+//longest time we sleep, even if libspotify does not need us
+#define SPOTIFY_MAX_SLEEP 1000
+
+SpotifyCommand::SpotifyCommand()
+{
+  m_isDone = false;
+  m_isStarted = false;
+  m_isCancelled = false;
+  m_result = SP_ERROR_OK;
+}
+
+sp_error SpotifyCommand::Wait(unsigned int timeout)
+{
+  if (!m_isDone && !m_doneEvent.WaitMSec(timeout) && !m_isDone)
+  {
+    {
+      CSingleLock lock(m_stateLock);
+      if (!m_isStarted)
+      {
+        //it would run after the caller has given up on it, with nobody there to see what it did
+        m_isCancelled = true;
+        CLog::Log( LOGERROR, "Spotifylog: command timed out, cancelled");
+        return SP_ERROR_OTHER_TRANSIENT;
+      }
+    }
+    //it is running under the session lock, that does not take long
+    while (!m_isDone)
+      m_doneEvent.WaitMSec(100);
+  }
+  return m_result;
+}
+
+bool SpotifyCommand::Start()
+{
+  CSingleLock lock(m_stateLock);
+  if (m_isCancelled)
+    return false;
+  m_isStarted = true;
+  return true;
+}
+
+void SpotifyCommand::SetResult(sp_error result)
+{
+  m_result = result;
+  m_isDone = true;
+  m_doneEvent.Set();
+}
+
+sp_error SpotifyPlayerPlayCommand::Execute(sp_session *session)
+{
+  return sp_session_player_play(session, m_play);
+}
+
+sp_error SpotifyPlayerSeekCommand::Execute(sp_session *session)
+{
+  sp_error error = sp_session_player_seek(session, m_offset);
+  if (SP_ERROR_OK == error)
+    error = sp_session_player_play(session, true);
+  return error;
+}
+
+sp_error SpotifyPlayerUnloadCommand::Execute(sp_session *session)
+{
+  sp_session_player_play(session, false);
+  sp_session_player_unload(session);
+  return SP_ERROR_OK;
+}
+
+SpotifySessionThread::SpotifySessionThread()
+{
+  m_session = 0;
+}
+
+SpotifySessionThread::~SpotifySessionThread()
+{
+  Stop();
+}
+
+void SpotifySessionThread::Start(sp_session *session)
+{
+  if (m_session)
+    return;
+  m_session = session;
+  Create();
+}
+
+void SpotifySessionThread::Stop()
+{
+  if (!m_session)
+    return;
+  m_bStop = true;
+  m_wakeEvent.Set();
+  StopThread();
+  //run whatever is left so no one waits forever
+  executeCommands();
+  m_session = 0;
+}
+
+SpotifyCommandPtr SpotifySessionThread::Post(SpotifyCommand *command)
+{
+  SpotifyCommandPtr pCommand(command);
+  if (!m_session)
+  {
+    pCommand->SetResult(SP_ERROR_OTHER_PERMANENT);
+    return pCommand;
+  }
+
+  //from a callback on our own thread we can run it right away
+  if (IsCurrentThread())
+  {
+    pCommand->Start();
+    pCommand->SetResult(pCommand->Execute(m_session));
+    return pCommand;
+  }
+
+  {
+    CSingleLock lock(m_queueLock);
+    m_queue.push_back(pCommand);
+  }
+  m_wakeEvent.Set();
+  return pCommand;
+}
+
+void SpotifySessionThread::Wake()
+{
+  m_wakeEvent.Set();
+}
+
+void SpotifySessionThread::executeCommands()
+{
+  while (true)
+  {
+    SpotifyCommandPtr pCommand;
+    {
+      CSingleLock lock(m_queueLock);
+      if (m_queue.empty())
+        return;
+      pCommand = m_queue.front();
+      m_queue.pop_front();
+    }
+    CSingleLock lock(m_sessionLock);
+    if (pCommand->Start())
+      pCommand->SetResult(pCommand->Execute(m_session));
+    else
+      CLog::Log( LOGDEBUG, "Spotifylog: skipping a cancelled command");
+  }
+}
+
+void SpotifySessionThread::Process()
+{
+  CLog::Log( LOGDEBUG, "Spotifylog: session thread started");
+  while (!m_bStop)
+  {
+    executeCommands();
+
+    int timeout;
+    {
+      CSingleLock lock(m_sessionLock);
+      timeout = g_spotifyInterface->processEvents();
+    }
+
+    if (timeout <= 0 || timeout > SPOTIFY_MAX_SLEEP)
+      timeout = timeout <= 0 ? 1 : SPOTIFY_MAX_SLEEP;
+    m_wakeEvent.WaitMSec(timeout);
+  }
+  CLog::Log( LOGDEBUG, "Spotifylog: session thread stopped");
+}
@@ -0,0 +1,130 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+#pragma once
+
+#ifndef SP_CALLCONV
+#ifdef _WIN32
+#define SP_CALLCONV __stdcall
+#else
+#define SP_CALLCONV
+#endif
+#endif
+
+#include <spotify/api.h>
+#include <deque>
+#include <boost/shared_ptr.hpp>
+#include "utils/Thread.h"
+#include "utils/Event.h"
+#include "utils/CriticalSection.h"
+
+//a call into libspotify that is executed on the session thread
+//the one posting it gets a pointer back and can wait for the result, like a future
+class SpotifyCommand
+{
+public:
+  SpotifyCommand();
+  virtual ~SpotifyCommand(){}
+
+  virtual sp_error Execute(sp_session *session) = 0;
+
+  //returns SP_ERROR_OTHER_TRANSIENT if the command did not start in time, it is cancelled then and never runs
+  //one that has started is waited for, the caller can count on its side effects either way
+  sp_error Wait(unsigned int timeout = 5000);
+  bool IsDone(){ return m_isDone; }
+  //called by the session thread before Execute, false if the command was cancelled
+  bool Start();
+  void SetResult(sp_error result);
+
+private:
+  CEvent m_doneEvent;
+  CCriticalSection m_stateLock;
+  volatile bool m_isDone;
+  bool m_isStarted;
+  bool m_isCancelled;
+  sp_error m_result;
+};
+
+typedef boost::shared_ptr<SpotifyCommand> SpotifyCommandPtr;
+
+//ui work asked for from the session thread, it is run on the gui thread so the session thread never waits for a dialog
+class SpotifyGuiCommand
+{
+public:
+  virtual ~SpotifyGuiCommand(){}
+  virtual void Execute() = 0;
+};
+
+typedef boost::shared_ptr<SpotifyGuiCommand> SpotifyGuiCommandPtr;
+
+//player commands
+class SpotifyPlayerPlayCommand : public SpotifyCommand
+{
+public:
+  SpotifyPlayerPlayCommand(bool play) : m_play(play) {}
+  virtual sp_error Execute(sp_session *session);
+private:
+  bool m_play;
+};
+
+class SpotifyPlayerSeekCommand : public SpotifyCommand
+{
+public:
+  SpotifyPlayerSeekCommand(int offset) : m_offset(offset) {}
+  virtual sp_error Execute(sp_session *session);
+private:
+  int m_offset;
+};
+
+class SpotifyPlayerUnloadCommand : public SpotifyCommand
+{
+public:
+  virtual sp_error Execute(sp_session *session);
+};
+
+//owns the libspotify session, everything that calls into libspotify either holds the session lock
+//or posts a command. It sleeps until libspotify asks to be processed or a command is posted
+class SpotifySessionThread : public CThread
+{
+public:
+  SpotifySessionThread();
+  virtual ~SpotifySessionThread();
+
+  void Start(sp_session *session);
+  void Stop();
+  bool IsRunning(){ return m_session != 0; }
+
+  SpotifyCommandPtr Post(SpotifyCommand *command);
+  void Wake();
+  CCriticalSection &GetLock(){ return m_sessionLock; }
+
+protected:
+  virtual void Process();
+
+private:
+  void executeCommands();
+
+  sp_session *m_session;
+  CEvent m_wakeEvent;
+  CCriticalSection m_sessionLock;
+  CCriticalSection m_queueLock;
+  std::deque<SpotifyCommandPtr> m_queue;
+};
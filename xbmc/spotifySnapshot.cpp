@@ -0,0 +1,406 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+
+#include "spotifySnapshot.h"
+#include "AdvancedSettings.h"
+#include "MusicInfoTag.h"
+#include "FileSystem/File.h"
+#include "FileSystem/Directory.h"
+#include "Util.h"
+#include "utils/SingleLock.h"
+#include "utils/log.h"
+#include <stdint.h>
+#include <string.h>
+
+using namespace std;
+using namespace XFILE;
+
+//bump it when the records change, old snapshots are then ignored
+#define SNAPSHOT_VERSION 1
+//a snapshot bigger than this is broken
+#define SNAPSHOT_MAX_SIZE (64 * 1024 * 1024)
+
+#pragma pack(push, 1)
+struct SnapshotHeader
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t numLists;
+  uint32_t numItems;
+  uint32_t stringsSize;
+};
+
+struct SnapshotList
+{
+  uint32_t name;
+  uint32_t firstItem;
+  uint32_t numItems;
+};
+
+struct SnapshotItem
+{
+  uint32_t path;
+  uint32_t label;
+  uint32_t thumb;
+  uint32_t title;
+  uint32_t artist;
+  uint32_t albumArtist;
+  uint32_t album;
+  int32_t duration;
+  int32_t track;
+  uint8_t flags;
+  char rating;
+  uint16_t reserved;
+};
+#pragma pack(pop)
+
+#define SNAPSHOT_ITEM_FOLDER 1
+#define SNAPSHOT_ITEM_SONG 2
+
+//the strings are written once each, the first one is the empty string
+class SnapshotStrings
+{
+public:
+  SnapshotStrings() { m_data.push_back('\0'); }
+  uint32_t Add(const CStdString &str)
+  {
+    if (str.IsEmpty())
+      return 0;
+    map<CStdString, uint32_t>::iterator it = m_offsets.find(str);
+    if (it != m_offsets.end())
+      return it->second;
+    uint32_t offset = m_data.size();
+    m_data.insert(m_data.end(), str.c_str(), str.c_str() + str.size() + 1);
+    m_offsets[str] = offset;
+    return offset;
+  }
+  const vector<char> &Data() { return m_data; }
+
+private:
+  vector<char> m_data;
+  map<CStdString, uint32_t> m_offsets;
+};
+
+SpotifySnapshot::SpotifySnapshot()
+{
+  m_isDirty = false;
+  m_writer = 0;
+  m_hasPending = false;
+}
+
+SpotifySnapshot::~SpotifySnapshot()
+{
+  Stop();
+}
+
+void SpotifySnapshot::Start()
+{
+  if (m_writer)
+    return;
+  m_writer = new Writer(*this);
+  m_writer->Create();
+}
+
+void SpotifySnapshot::Stop()
+{
+  if (m_writer)
+  {
+    m_writeEvent.Set();
+    m_writer->StopThread();
+    delete m_writer;
+    m_writer = 0;
+  }
+  writePending();
+}
+
+void SpotifySnapshot::Writer::Process()
+{
+  while (!m_bStop)
+  {
+    m_snapshot.m_writeEvent.WaitMSec(1000);
+    m_snapshot.writePending();
+  }
+}
+
+void SpotifySnapshot::writePending()
+{
+  ListMap lists;
+  {
+    CSingleLock lock(m_lock);
+    if (!m_hasPending)
+      return;
+    lists.swap(m_pending);
+    m_hasPending = false;
+  }
+  write(lists);
+}
+
+CStdString SpotifySnapshot::getFileName()
+{
+  return CUtil::AddFileToFolder(g_advancedSettings.m_spotifyCacheFolder, "snapshot");
+}
+
+bool SpotifySnapshot::Load()
+{
+  m_lists.clear();
+  m_isDirty = false;
+
+  CFile file;
+  if (!file.Open(getFileName()))
+    return false;
+  int64_t length = file.GetLength();
+  if (length < (int64_t)sizeof(SnapshotHeader) || length > SNAPSHOT_MAX_SIZE)
+  {
+    file.Close();
+    return false;
+  }
+  vector<char> data((size_t)length);
+  bool isRead = file.Read(&data[0], length) == length;
+  file.Close();
+  if (!isRead)
+    return false;
+
+  const SnapshotHeader *header = (const SnapshotHeader*)&data[0];
+  if (memcmp(header->magic, "SPSN", 4) != 0 || header->version != SNAPSHOT_VERSION)
+  {
+    CLog::Log(LOGNOTICE, "Spotifylog: ignoring a snapshot from another version");
+    return false;
+  }
+  uint64_t expected = sizeof(SnapshotHeader) + (uint64_t)header->numLists * sizeof(SnapshotList) + (uint64_t)header->numItems * sizeof(SnapshotItem) + header->stringsSize;
+  if (expected != (uint64_t)length || header->stringsSize == 0)
+  {
+    CLog::Log(LOGERROR, "Spotifylog: the snapshot is broken");
+    return false;
+  }
+
+  const SnapshotList *lists = (const SnapshotList*)(header + 1);
+  const SnapshotItem *records = (const SnapshotItem*)(lists + header->numLists);
+  const char *strings = (const char*)(records + header->numItems);
+  uint32_t stringsSize = header->stringsSize;
+  if (strings[stringsSize - 1] != '\0')
+    return false;
+
+  for (uint32_t i = 0; i < header->numLists; i++)
+  {
+    const SnapshotList &list = lists[i];
+    if (list.name >= stringsSize || list.firstItem > header->numItems || list.numItems > header->numItems - list.firstItem)
+    {
+      CLog::Log(LOGERROR, "Spotifylog: the snapshot is broken");
+      m_lists.clear();
+      return false;
+    }
+    ListPtr &listItems = m_lists[strings + list.name];
+    listItems.reset(new vector<Item>(list.numItems));
+    vector<Item> &items = *listItems;
+    for (uint32_t j = 0; j < list.numItems; j++)
+    {
+      const SnapshotItem &record = records[list.firstItem + j];
+      if (record.path >= stringsSize || record.label >= stringsSize || record.thumb >= stringsSize || record.title >= stringsSize
+          || record.artist >= stringsSize || record.albumArtist >= stringsSize || record.album >= stringsSize)
+      {
+        CLog::Log(LOGERROR, "Spotifylog: the snapshot is broken");
+        m_lists.clear();
+        return false;
+      }
+      Item &item = items[j];
+      item.path = strings + record.path;
+      item.label = strings + record.label;
+      item.thumb = strings + record.thumb;
+      item.title = strings + record.title;
+      item.artist = strings + record.artist;
+      item.albumArtist = strings + record.albumArtist;
+      item.album = strings + record.album;
+      item.duration = record.duration;
+      item.track = record.track;
+      item.isFolder = (record.flags & SNAPSHOT_ITEM_FOLDER) != 0;
+      item.isSong = (record.flags & SNAPSHOT_ITEM_SONG) != 0;
+      item.rating = record.rating;
+    }
+  }
+  CLog::Log(LOGDEBUG, "Spotifylog: loaded a snapshot with %u lists", header->numLists);
+  return true;
+}
+
+void SpotifySnapshot::Save()
+{
+  if (!m_isDirty)
+    return;
+  {
+    CSingleLock lock(m_lock);
+    m_pending = m_lists;
+    m_hasPending = true;
+  }
+  m_isDirty = false;
+  if (m_writer)
+    m_writeEvent.Set();
+  else
+    writePending();
+}
+
+bool SpotifySnapshot::write(const ListMap &lists)
+{
+  SnapshotStrings strings;
+  vector<SnapshotList> listRecords;
+  vector<SnapshotItem> records;
+  for (ListMap::const_iterator it = lists.begin(); it != lists.end(); ++it)
+  {
+    SnapshotList list;
+    list.name = strings.Add(it->first);
+    list.firstItem = records.size();
+    list.numItems = it->second->size();
+    listRecords.push_back(list);
+    for (vector<Item>::const_iterator item = it->second->begin(); item != it->second->end(); ++item)
+    {
+      SnapshotItem record;
+      memset(&record, 0, sizeof(record));
+      record.path = strings.Add(item->path);
+      record.label = strings.Add(item->label);
+      record.thumb = strings.Add(item->thumb);
+      record.title = strings.Add(item->title);
+      record.artist = strings.Add(item->artist);
+      record.albumArtist = strings.Add(item->albumArtist);
+      record.album = strings.Add(item->album);
+      record.duration = item->duration;
+      record.track = item->track;
+      record.flags = (item->isFolder ? SNAPSHOT_ITEM_FOLDER : 0) | (item->isSong ? SNAPSHOT_ITEM_SONG : 0);
+      record.rating = item->rating;
+      records.push_back(record);
+    }
+  }
+
+  SnapshotHeader header;
+  memcpy(header.magic, "SPSN", 4);
+  header.version = SNAPSHOT_VERSION;
+  header.numLists = listRecords.size();
+  header.numItems = records.size();
+  header.stringsSize = strings.Data().size();
+
+  //write it next to the old one and swap, a crash halfway should not leave a broken snapshot
+  CDirectory::Create(g_advancedSettings.m_spotifyCacheFolder);
+  CStdString fileName = getFileName();
+  CStdString tempName = fileName + ".tmp";
+  CFile file;
+  if (!file.OpenForWrite(tempName, true))
+  {
+    CLog::Log(LOGERROR, "Spotifylog: could not write the snapshot");
+    return false;
+  }
+  file.Write(&header, sizeof(header));
+  if (!listRecords.empty())
+    file.Write(&listRecords[0], listRecords.size() * sizeof(SnapshotList));
+  if (!records.empty())
+    file.Write(&records[0], records.size() * sizeof(SnapshotItem));
+  file.Write(&strings.Data()[0], strings.Data().size());
+  file.Close();
+
+  CFile::Delete(fileName);
+  if (!CFile::Rename(tempName, fileName))
+  {
+    CLog::Log(LOGERROR, "Spotifylog: could not replace the snapshot");
+    return false;
+  }
+  return true;
+}
+
+void SpotifySnapshot::Clear()
+{
+  m_lists.clear();
+  m_isDirty = true;
+}
+
+bool SpotifySnapshot::Get(const CStdString &name, CFileItemList &items)
+{
+  ListMap::iterator it = m_lists.find(name);
+  if (it == m_lists.end())
+    return false;
+
+  for (vector<Item>::iterator item = it->second->begin(); item != it->second->end(); ++item)
+  {
+    CFileItemPtr pItem(new CFileItem(item->label));
+    pItem->m_strPath = item->path;
+    pItem->m_bIsFolder = item->isFolder;
+    if (item->isSong)
+    {
+      MUSIC_INFO::CMusicInfoTag *tag = pItem->GetMusicInfoTag();
+      tag->SetURL(item->path);
+      tag->SetTitle(item->title);
+      tag->SetArtist(item->artist);
+      tag->SetAlbumArtist(item->albumArtist);
+      tag->SetAlbum(item->album);
+      tag->SetDuration(item->duration);
+      tag->SetTrackNumber(item->track);
+      tag->SetRating(item->rating);
+      tag->SetLoaded(true);
+    }
+    if (!item->thumb.IsEmpty())
+      pItem->SetThumbnailImage(item->thumb);
+    items.Add(pItem);
+  }
+  return true;
+}
+
+void SpotifySnapshot::Set(const CStdString &name, const CFileItemList &items)
+{
+  ListPtr listItems(new vector<Item>(items.Size()));
+  vector<Item> &list = *listItems;
+  for (int i = 0; i < items.Size(); i++)
+  {
+    CFileItemPtr pItem = items[i];
+    Item &item = list[i];
+    item.path = pItem->m_strPath;
+    item.label = pItem->GetLabel();
+    item.thumb = pItem->GetThumbnailImage();
+    item.isFolder = pItem->m_bIsFolder;
+    item.isSong = pItem->HasMusicInfoTag();
+    item.duration = 0;
+    item.track = 0;
+    item.rating = '0';
+    if (item.isSong)
+    {
+      const MUSIC_INFO::CMusicInfoTag *tag = pItem->GetMusicInfoTag();
+      item.title = tag->GetTitle();
+      item.artist = tag->GetArtist();
+      item.albumArtist = tag->GetAlbumArtist();
+      item.album = tag->GetAlbum();
+      item.duration = tag->GetDuration();
+      item.track = tag->GetTrackNumber();
+      item.rating = tag->GetRating();
+    }
+  }
+  m_lists[name] = listItems;
+  m_isDirty = true;
+}
+
+void SpotifySnapshot::Remove(const CStdString &prefix)
+{
+  ListMap::iterator it = m_lists.begin();
+  while (it != m_lists.end())
+  {
+    if (it->first.Left(prefix.size()) == prefix)
+    {
+      m_lists.erase(it++);
+      m_isDirty = true;
+    }
+    else
+      ++it;
+  }
+}
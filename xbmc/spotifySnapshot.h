@@ -0,0 +1,103 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+
+#pragma once
+
+#include "StdString.h"
+#include "FileItem.h"
+#include "utils/Thread.h"
+#include "utils/Event.h"
+#include "utils/CriticalSection.h"
+#include <map>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+//the playlists and toplists as they were the last time, so the menus can be shown before spotify has logged in
+//the file is flat binary: a header, the list records, the item records and then the strings
+//the records have a fixed size and point into the strings by offset, nothing has to be parsed to find an item
+class SpotifySnapshot
+{
+public:
+  SpotifySnapshot();
+  ~SpotifySnapshot();
+
+  //the file is written on a thread of its own once it is started, Stop writes what is left
+  void Start();
+  void Stop();
+
+  //returns false if there is no snapshot or it was written by another version
+  bool Load();
+  //hands the lists to the writer if anything was changed since the last time, the caller does not wait for the disk
+  void Save();
+  void Clear();
+
+  //appends the stored list to items, returns false if we have no such list
+  bool Get(const CStdString &name, CFileItemList &items);
+  void Set(const CStdString &name, const CFileItemList &items);
+  //removes all lists whose name starts with prefix
+  void Remove(const CStdString &prefix);
+
+private:
+  struct Item
+  {
+    CStdString path;
+    CStdString label;
+    CStdString thumb;
+    CStdString title;
+    CStdString artist;
+    CStdString albumArtist;
+    CStdString album;
+    int duration;
+    int track;
+    bool isFolder;
+    bool isSong;
+    char rating;
+  };
+  //a list is never changed once it is in the map, Set puts a new one there
+  //so Save only copies the pointers and the writer can read them while we go on
+  typedef boost::shared_ptr<std::vector<Item> > ListPtr;
+  typedef std::map<CStdString, ListPtr> ListMap;
+
+  class Writer : public CThread
+  {
+  public:
+    Writer(SpotifySnapshot &snapshot) : m_snapshot(snapshot) {}
+  protected:
+    virtual void Process();
+  private:
+    SpotifySnapshot &m_snapshot;
+  };
+
+  static CStdString getFileName();
+  static bool write(const ListMap &lists);
+  //writes the lists that are waiting, on the writer thread or from Stop
+  void writePending();
+
+  ListMap m_lists;
+  bool m_isDirty;
+
+  Writer *m_writer;
+  CCriticalSection m_lock;
+  CEvent m_writeEvent;
+  ListMap m_pending;
+  bool m_hasPending;
+};
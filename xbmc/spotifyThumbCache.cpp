@@ -0,0 +1,263 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+
+#include "spotifyThumbCache.h"
+#include "AdvancedSettings.h"
+#include "FileSystem/File.h"
+#include "FileSystem/Directory.h"
+#include "Util.h"
+#include "utils/log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using namespace std;
+using namespace XFILE;
+
+#define THUMBCACHE_VERSION 1
+#define THUMBCACHE_ID_SIZE 20
+//write the index now and then, not only when we quit
+#define THUMBCACHE_SAVE_INTERVAL 50
+
+#pragma pack(push, 1)
+struct ThumbCacheHeader
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t clock;
+  uint32_t numEntries;
+};
+
+struct ThumbCacheRecord
+{
+  unsigned char imageId[THUMBCACHE_ID_SIZE];
+  uint32_t size;
+  uint32_t lastUsed;
+};
+#pragma pack(pop)
+
+SpotifyThumbCache::SpotifyThumbCache()
+{
+  m_totalSize = 0;
+  m_clock = 0;
+  m_keepClock = 0;
+  m_unsaved = 0;
+  m_isDirty = false;
+}
+
+CStdString SpotifyThumbCache::getKey(const unsigned char *imageId)
+{
+  CStdString key;
+  for (int i = 0; i < THUMBCACHE_ID_SIZE; i++)
+  {
+    CStdString hex;
+    hex.Format("%02x", imageId[i]);
+    key += hex;
+  }
+  return key;
+}
+
+CStdString SpotifyThumbCache::getFolder()
+{
+  //the xbmc thumbnail folder, it is not emptied when xbmc starts like temp is
+  return "special://thumbnails/Spotify/";
+}
+
+CStdString SpotifyThumbCache::GetPath(const unsigned char *imageId)
+{
+  CStdString path;
+  path.Format("%s%s.tbn", getFolder().c_str(), getKey(imageId).c_str());
+  return path;
+}
+
+bool SpotifyThumbCache::Has(const unsigned char *imageId)
+{
+  EntryMap::iterator it = m_entries.find(getKey(imageId));
+  if (it == m_entries.end())
+    return false;
+  use(it);
+  return true;
+}
+
+void SpotifyThumbCache::Touch(const CStdString &path)
+{
+  if (path.Left(getFolder().size()) != getFolder())
+    return;
+  CStdString key = CUtil::GetFileName(path);
+  CUtil::RemoveExtension(key);
+  EntryMap::iterator it = m_entries.find(key);
+  if (it != m_entries.end())
+    use(it);
+}
+
+void SpotifyThumbCache::use(EntryMap::iterator it)
+{
+  m_uses.erase(it->second.use);
+  it->second.lastUsed = ++m_clock;
+  it->second.use = m_uses.insert(make_pair(it->second.lastUsed, it->first));
+  m_isDirty = true;
+}
+
+void SpotifyThumbCache::Added(const unsigned char *imageId, int64_t size)
+{
+  CStdString key = getKey(imageId);
+  EntryMap::iterator it = m_entries.find(key);
+  if (it == m_entries.end())
+  {
+    Entry entry;
+    entry.size = 0;
+    entry.lastUsed = 0;
+    it = m_entries.insert(make_pair(key, entry)).first;
+    it->second.use = m_uses.insert(make_pair(0, key));
+  }
+  m_totalSize -= it->second.size;
+  it->second.size = (uint32_t)size;
+  m_totalSize += it->second.size;
+  use(it);
+  evict();
+  if (++m_unsaved >= THUMBCACHE_SAVE_INTERVAL)
+    Save();
+}
+
+void SpotifyThumbCache::evict()
+{
+  uint64_t budget = (uint64_t)g_advancedSettings.m_spotifyThumbCacheSize * 1024 * 1024;
+  if (m_totalSize <= budget)
+    return;
+
+  //go down to nine tenths so we dont do this for every new thumb
+  //the thumbs of the listing on screen stay, even if that leaves us over the budget for a while
+  uint64_t target = budget / 10 * 9;
+  int removed = 0;
+  while (m_totalSize > target && !m_uses.empty() && m_uses.begin()->first <= m_keepClock)
+  {
+    EntryMap::iterator oldest = m_entries.find(m_uses.begin()->second);
+    m_uses.erase(m_uses.begin());
+    if (oldest == m_entries.end())
+      continue;
+    CStdString path;
+    path.Format("%s%s.tbn", getFolder().c_str(), oldest->first.c_str());
+    CFile::Delete(path);
+    m_totalSize -= oldest->second.size;
+    m_entries.erase(oldest);
+    removed++;
+  }
+  CLog::Log(LOGDEBUG, "Spotifylog: removed %i thumbs from the cache, %i left", removed, (int)m_entries.size());
+}
+
+bool SpotifyThumbCache::Load()
+{
+  m_entries.clear();
+  m_uses.clear();
+  m_totalSize = 0;
+  m_clock = 0;
+  m_keepClock = 0;
+  m_unsaved = 0;
+  m_isDirty = false;
+  CDirectory::Create(getFolder());
+
+  CFile file;
+  if (!file.Open(CUtil::AddFileToFolder(getFolder(), "index")))
+    return false;
+  ThumbCacheHeader header;
+  bool isRead = file.Read(&header, sizeof(header)) == sizeof(header);
+  if (!isRead || memcmp(header.magic, "SPTC", 4) != 0 || header.version != THUMBCACHE_VERSION
+    || file.GetLength() != (int64_t)(sizeof(header) + (uint64_t)header.numEntries * sizeof(ThumbCacheRecord)))
+  {
+    file.Close();
+    CLog::Log(LOGNOTICE, "Spotifylog: ignoring a broken thumb cache index");
+    return false;
+  }
+  vector<ThumbCacheRecord> records(header.numEntries);
+  if (header.numEntries > 0)
+    isRead = file.Read(&records[0], records.size() * sizeof(ThumbCacheRecord)) == (int64_t)(records.size() * sizeof(ThumbCacheRecord));
+  file.Close();
+  if (!isRead)
+    return false;
+
+  m_clock = header.clock;
+  for (unsigned int i = 0; i < records.size(); i++)
+  {
+    CStdString key = getKey(records[i].imageId);
+    if (m_entries.find(key) != m_entries.end())
+      continue;
+    Entry &entry = m_entries[key];
+    entry.size = records[i].size;
+    entry.lastUsed = records[i].lastUsed;
+    entry.use = m_uses.insert(make_pair(entry.lastUsed, key));
+    m_totalSize += entry.size;
+  }
+  //nothing from the last session is on screen yet
+  m_keepClock = m_clock;
+  CLog::Log(LOGDEBUG, "Spotifylog: thumb cache has %i thumbs, %u kB", (int)m_entries.size(), (unsigned int)(m_totalSize / 1024));
+  //the budget may have been made smaller
+  evict();
+  return true;
+}
+
+bool SpotifyThumbCache::Save()
+{
+  m_unsaved = 0;
+  if (!m_isDirty)
+    return true;
+
+  ThumbCacheHeader header;
+  memcpy(header.magic, "SPTC", 4);
+  header.version = THUMBCACHE_VERSION;
+  header.clock = m_clock;
+  header.numEntries = m_entries.size();
+
+  vector<ThumbCacheRecord> records;
+  records.reserve(m_entries.size());
+  for (EntryMap::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+  {
+    ThumbCacheRecord record;
+    for (int i = 0; i < THUMBCACHE_ID_SIZE; i++)
+      record.imageId[i] = (unsigned char)strtol(it->first.Mid(i * 2, 2).c_str(), 0, 16);
+    record.size = it->second.size;
+    record.lastUsed = it->second.lastUsed;
+    records.push_back(record);
+  }
+
+  //write it next to the old one and swap like the snapshot
+  CStdString fileName = CUtil::AddFileToFolder(getFolder(), "index");
+  CStdString tempName = fileName + ".tmp";
+  CFile file;
+  if (!file.OpenForWrite(tempName, true))
+  {
+    CLog::Log(LOGERROR, "Spotifylog: could not write the thumb cache index");
+    return false;
+  }
+  file.Write(&header, sizeof(header));
+  if (!records.empty())
+    file.Write(&records[0], records.size() * sizeof(ThumbCacheRecord));
+  file.Close();
+
+  CFile::Delete(fileName);
+  if (!CFile::Rename(tempName, fileName))
+  {
+    CLog::Log(LOGERROR, "Spotifylog: could not replace the thumb cache index");
+    return false;
+  }
+  m_isDirty = false;
+  return true;
+}
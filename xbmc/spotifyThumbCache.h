@@ -0,0 +1,78 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+
+#pragma once
+
+#include "StdString.h"
+#include <stdint.h>
+#include <map>
+
+//the album covers on disk, kept by the 20 byte image id so the same cover is one file for every list it is in
+//they stay between sessions, the least recently used ones are thrown away when the cache gets bigger than the budget
+//it is only used with the session lock held
+class SpotifyThumbCache
+{
+public:
+  SpotifyThumbCache();
+
+  bool Load();
+  //writes the index if something has changed
+  bool Save();
+
+  //where the thumb of an image goes, it may not be there yet
+  CStdString GetPath(const unsigned char *imageId);
+  //true if the index has the thumb, it is then the most recently used one
+  //a thumb that was written after the index was last saved is fetched again, the disk is not asked
+  bool Has(const unsigned char *imageId);
+  //a thumb has been written
+  void Added(const unsigned char *imageId, int64_t size);
+  //the thumb of an item we show, like the ones from the snapshot, is used again
+  void Touch(const CStdString &path);
+  //a new listing is shown, the thumbs used from now on are not thrown away until the next one
+  void NewListing(){ m_keepClock = m_clock; }
+
+private:
+  //the entries by their last use, so the oldest one is found without a search
+  typedef std::multimap<uint32_t, CStdString> UseMap;
+  struct Entry
+  {
+    uint32_t size;
+    uint32_t lastUsed;
+    UseMap::iterator use;
+  };
+  typedef std::map<CStdString, Entry> EntryMap;
+
+  static CStdString getKey(const unsigned char *imageId);
+  CStdString getFolder();
+  void evict();
+  void use(EntryMap::iterator it);
+
+  EntryMap m_entries;
+  UseMap m_uses;
+  uint64_t m_totalSize;
+  //counts up every time a thumb is used, the lowest one goes first
+  uint32_t m_clock;
+  //the clock when the listing on screen was started, the thumbs used after it are on screen
+  uint32_t m_keepClock;
+  int m_unsaved;
+  bool m_isDirty;
+};
@@ -0,0 +1,175 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+
+#include "spotifyThumbWriter.h"
+#include "spotifySession.h"
+#include "Picture.h"
+#include "FileSystem/File.h"
+#include "utils/SingleLock.h"
+#include "utils/log.h"
+
+using namespace std;
+using namespace XFILE;
+
+//decoding is what takes time, two is enough for a screen of covers
+#define THUMBWRITER_WORKERS 2
+
+SpotifyThumbWriter::SpotifyThumbWriter(SpotifySessionThread &sessionThread)
+  : m_sessionThread(sessionThread)
+{
+  m_isStopping = false;
+}
+
+SpotifyThumbWriter::~SpotifyThumbWriter()
+{
+  Stop();
+}
+
+void SpotifyThumbWriter::Start()
+{
+  if (!m_workers.empty())
+    return;
+  m_isStopping = false;
+  for (int i = 0; i < THUMBWRITER_WORKERS; i++)
+  {
+    Worker *worker = new Worker(*this);
+    worker->Create();
+    m_workers.push_back(worker);
+  }
+}
+
+void SpotifyThumbWriter::Stop()
+{
+  {
+    CSingleLock lock(m_lock);
+    m_isStopping = true;
+    m_jobs.clear();
+  }
+  for (unsigned int i = 0; i < m_workers.size(); i++)
+  {
+    m_jobEvent.Set();
+    m_workers[i]->StopThread();
+    delete m_workers[i];
+  }
+  m_workers.clear();
+}
+
+void SpotifyThumbWriter::Write(const CStdString &fileName, const void *data, size_t size)
+{
+  CSingleLock lock(m_lock);
+  Job job;
+  m_jobs.push_back(job);
+  m_jobs.back().fileName = fileName;
+  m_jobs.back().data.assign((const unsigned char*)data, (const unsigned char*)data + size);
+  m_jobEvent.Set();
+}
+
+void SpotifyThumbWriter::Copy(const CStdString &from, const CStdString &to)
+{
+  CSingleLock lock(m_lock);
+  Job job;
+  job.fileName = to;
+  job.from = from;
+  m_jobs.push_back(job);
+  m_jobEvent.Set();
+}
+
+void SpotifyThumbWriter::GetResults(vector<Result> &results)
+{
+  CSingleLock lock(m_lock);
+  results.swap(m_results);
+  m_results.clear();
+}
+
+bool SpotifyThumbWriter::getJob(Job &job)
+{
+  CSingleLock lock(m_lock);
+  if (m_jobs.empty() || m_isStopping)
+    return false;
+  //swap, the image data is not copied again
+  job.fileName = m_jobs.front().fileName;
+  job.from = m_jobs.front().from;
+  job.data.swap(m_jobs.front().data);
+  m_jobs.pop_front();
+  return true;
+}
+
+void SpotifyThumbWriter::doJob(Job &job)
+{
+  //copies post no result on purpose, nobody waits for them, the item is given the new path when the copy is asked for
+  if (!job.from.IsEmpty())
+  {
+    CPicture::CacheThumb(job.from, job.fileName);
+    return;
+  }
+
+  //written next to it and renamed, nobody should find half a thumb
+  Result result;
+  result.fileName = job.fileName;
+  result.size = 0;
+  result.isWritten = false;
+  CStdString tempName = job.fileName + ".tmp";
+  if (job.data.empty())
+  {
+    //spotify gave us no image, the request still has to hear that it failed
+    CLog::Log(LOGERROR, "Spotifylog: no image data for thumb %s", job.fileName.c_str());
+  }else if (!CPicture::CreateThumbnailFromMemory(&job.data[0], job.data.size(), "jpg", tempName))
+  {
+    //could not decode it, keep the image as it is
+    CFile file;
+    if (file.OpenForWrite(tempName, true))
+    {
+      if (file.Write(&job.data[0], job.data.size()) != (int)job.data.size())
+        CLog::Log(LOGERROR, "Spotifylog: error creating thumb %s", job.fileName.c_str());
+      file.Close();
+    }
+  }
+
+  CFile file;
+  if (!job.data.empty() && file.Open(tempName))
+  {
+    result.size = file.GetLength();
+    file.Close();
+    CFile::Delete(job.fileName);
+    result.isWritten = result.size > 0 && CFile::Rename(tempName, job.fileName);
+  }
+  if (!result.isWritten)
+    CFile::Delete(tempName);
+
+  {
+    CSingleLock lock(m_lock);
+    m_results.push_back(result);
+  }
+  m_sessionThread.Wake();
+}
+
+void SpotifyThumbWriter::Worker::Process()
+{
+  while (!m_bStop)
+  {
+    Job job;
+    if (m_writer.getJob(job))
+      m_writer.doJob(job);
+    else
+      m_writer.m_jobEvent.WaitMSec(1000);
+  }
+}
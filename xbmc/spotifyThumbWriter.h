@@ -0,0 +1,90 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+
+#pragma once
+
+#include "StdString.h"
+#include "utils/Thread.h"
+#include "utils/Event.h"
+#include "utils/CriticalSection.h"
+#include <stdint.h>
+#include <deque>
+#include <vector>
+
+class SpotifySessionThread;
+
+//writes the covers on a couple of threads of its own so the session thread never waits for the disk
+//the image is decoded once and written scaled to the thumb size of the skin, the session thread is woken
+//when one is done and picks the results up from processEvents
+class SpotifyThumbWriter
+{
+public:
+  SpotifyThumbWriter(SpotifySessionThread &sessionThread);
+  ~SpotifyThumbWriter();
+
+  void Start();
+  //the jobs that have not started are dropped
+  void Stop();
+
+  //the data is copied, it can be released when this returns
+  void Write(const CStdString &fileName, const void *data, size_t size);
+  //copies a thumb that has been written, like the one of the playing track
+  void Copy(const CStdString &from, const CStdString &to);
+
+  struct Result
+  {
+    CStdString fileName;
+    int64_t size;
+    bool isWritten;
+  };
+  //the writes that are done since the last time
+  void GetResults(std::vector<Result> &results);
+
+private:
+  struct Job
+  {
+    CStdString fileName;
+    CStdString from;
+    std::vector<unsigned char> data;
+  };
+
+  class Worker : public CThread
+  {
+  public:
+    Worker(SpotifyThumbWriter &writer) : m_writer(writer) {}
+  protected:
+    virtual void Process();
+  private:
+    SpotifyThumbWriter &m_writer;
+  };
+
+  bool getJob(Job &job);
+  void doJob(Job &job);
+
+  SpotifySessionThread &m_sessionThread;
+  std::vector<Worker*> m_workers;
+  std::deque<Job> m_jobs;
+  std::vector<Result> m_results;
+  CCriticalSection m_lock;
+  CEvent m_jobEvent;
+  volatile bool m_isStopping;
+};
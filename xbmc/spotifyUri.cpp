@@ -0,0 +1,125 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+
+#include "spotifyUri.h"
+#include "utils/log.h"
+
+using namespace std;
+
+//a few hundred kilobytes, it starts over when it gets bigger than this
+#define URI_MAX_ENTRIES 20000
+
+SpotifyUri::SpotifyUri()
+{
+  m_linksCreated = 0;
+  m_linksReleased = 0;
+  m_hits = 0;
+  m_misses = 0;
+}
+
+SpotifyUri::~SpotifyUri()
+{
+  Clear();
+}
+
+const CStdString &SpotifyUri::Track(sp_track *track)
+{
+  return get(track, TRACK);
+}
+
+const CStdString &SpotifyUri::Album(sp_album *album)
+{
+  return get(album, ALBUM);
+}
+
+const CStdString &SpotifyUri::Artist(sp_artist *artist)
+{
+  return get(artist, ARTIST);
+}
+
+const CStdString &SpotifyUri::get(void *object, TYPE type)
+{
+  EntryMap::iterator it = m_entries.find(object);
+  if (it != m_entries.end() && it->second.type == type)
+  {
+    m_hits++;
+    return it->second.uri;
+  }
+
+  m_misses++;
+  if (m_entries.size() >= URI_MAX_ENTRIES)
+  {
+    LogStats();
+    Clear();
+  }
+
+  sp_link *spLink = 0;
+  if (type == TRACK)
+  {
+    spLink = sp_link_create_from_track((sp_track*)object, 0);
+    sp_track_add_ref((sp_track*)object);
+  }
+  else if (type == ALBUM)
+  {
+    spLink = sp_link_create_from_album((sp_album*)object);
+    sp_album_add_ref((sp_album*)object);
+  }
+  else
+  {
+    spLink = sp_link_create_from_artist((sp_artist*)object);
+    sp_artist_add_ref((sp_artist*)object);
+  }
+
+  Entry &entry = m_entries[object];
+  entry.type = type;
+  entry.uri = "";
+  if (spLink)
+  {
+    m_linksCreated++;
+    char spotify_uri[256];
+    if (sp_link_as_string(spLink, spotify_uri, sizeof(spotify_uri)) > 0)
+      entry.uri = spotify_uri;
+    sp_link_release(spLink);
+    m_linksReleased++;
+  }
+  return entry.uri;
+}
+
+void SpotifyUri::Clear()
+{
+  for (EntryMap::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+  {
+    if (it->second.type == TRACK)
+      sp_track_release((sp_track*)it->first);
+    else if (it->second.type == ALBUM)
+      sp_album_release((sp_album*)it->first);
+    else
+      sp_artist_release((sp_artist*)it->first);
+  }
+  m_entries.clear();
+}
+
+void SpotifyUri::LogStats()
+{
+  CLog::Log(LOGDEBUG, "Spotifylog: uris %i, hits %u, misses %u, links created %u, released %u, leaked %u",
+    (int)m_entries.size(), m_hits, m_misses, m_linksCreated, m_linksReleased, m_linksCreated - m_linksReleased);
+}
@@ -0,0 +1,63 @@
+/*
+    spotyxbmc - A project to integrate Spotify into XBMC
+    Copyright (C) 2010  David Erenger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    For contact with the author:
+    david.erenger@gmail.com
+*/
+
+
+#pragma once
+
+#include "StdString.h"
+#include <spotify/api.h>
+#include <map>
+
+//the uris of the tracks, albums and artists we have converted, each one is made once from a link that is released right away
+//the table holds a reference to every object in it so a pointer can not be reused for another object while it is there
+//it is only used with the session lock held
+class SpotifyUri
+{
+public:
+  SpotifyUri();
+  ~SpotifyUri();
+
+  const CStdString &Track(sp_track *track);
+  const CStdString &Album(sp_album *album);
+  const CStdString &Artist(sp_artist *artist);
+
+  //releases the objects, do it before the session goes away
+  void Clear();
+  void LogStats();
+
+private:
+  enum TYPE { TRACK, ALBUM, ARTIST };
+  struct Entry
+  {
+    TYPE type;
+    CStdString uri;
+  };
+  typedef std::map<void*, Entry> EntryMap;
+
+  const CStdString &get(void *object, TYPE type);
+
+  EntryMap m_entries;
+  //the links we made and released, the two should always be the same
+  unsigned int m_linksCreated;
+  unsigned int m_linksReleased;
+  unsigned int m_hits;
+  unsigned int m_misses;
+};
@@ -30,6 +30,8 @@
 #include "LocalizeStrings.h"
 #include <cstdlib>
 #include <stdint.h>
+#include <algorithm>
+#include <string.h>
 #include "MusicInfoTag.h"
 #include "FileSystem/FileMusicDatabase.h"
 #include "MusicDatabase.h"
@@ -41,6 +43,9 @@
 #include "FileSystem/Directory.h"
 #include "GUIDialogBusy.h"
 #include "cores/paplayer/spotifyCodec.h"
+#include "cores/paplayer/spotifyStats.h"
+#include "cores/paplayer/spotifyResampler.h"
+#include "utils/SingleLock.h"
 
 using namespace std;
 using namespace XFILE;
@@ -53,23 +58,121 @@ INSERT KEY HERE
 
 const size_t g_appkey_size = sizeof(g_appkey);
 
-//spotify session callbacks
-bool SpotifyInterface::processEvents()
+//logs out when the user cancels the reconnect dialog
+class SpotifyLogoutCommand : public SpotifyCommand
 {
-  //did the user cancel the connection process?
-  if (m_isShowingReconnect && m_reconectingDialog->IsCanceled())
+public:
+  virtual sp_error Execute(sp_session *session)
   {
-    hideReconectingDialog();
-    disconnect();
+    g_spotifyInterface->disconnect();
+    return SP_ERROR_OK;
   }
-  //do we need to process the spotify api?
-  int now = CTimeUtils::GetTimeMS();
-  if (now >= m_nextEvent)
+};
+
+//asks if the user wants to reconnect, from the gui thread
+class SpotifyConnectionErrorCommand : public SpotifyGuiCommand
+{
+public:
+  SpotifyConnectionErrorCommand(sp_error error) : m_error(error) {}
+  virtual void Execute(){ g_spotifyInterface->showConnectionErrorDialog(m_error); }
+private:
+  sp_error m_error;
+};
+
+//logs in again after a connection error, the user has answered the dialog by now
+class SpotifyConnectCommand : public SpotifyCommand
+{
+public:
+  SpotifyConnectCommand(bool forceNewUser, const CStdString &username, const CStdString &password)
+    : m_forceNewUser(forceNewUser), m_username(username), m_password(password) {}
+  virtual sp_error Execute(sp_session *session)
   {
-    sp_session_process_events(m_session, &m_nextEvent);
-    m_nextEvent += now;
+    return g_spotifyInterface->connect(m_forceNewUser, m_username, m_password) ? SP_ERROR_OK : SP_ERROR_OTHER_PERMANENT;
   }
-  return true;
+private:
+  bool m_forceNewUser;
+  CStdString m_username;
+  CStdString m_password;
+};
+
+//throws away a search the user did not mean and makes the one suggested instead
+class SpotifySearchAgainCommand : public SpotifyCommand
+{
+public:
+  SpotifySearchAgainCommand(const CStdString &query, const CStdString &suggestion) : m_query(query), m_suggestion(suggestion) {}
+  virtual sp_error Execute(sp_session *session)
+  {
+    SpotifyInterface *spInt = g_spotifyInterface;
+    SpotifyInterface::SearchPtr entry = spInt->m_searchCache.Peek(spInt->getSearchKey(m_query));
+    if (entry && spInt->m_currentSearch == entry)
+      spInt->m_currentSearch.reset();
+    spInt->m_searchCache.Remove(spInt->getSearchKey(m_query));
+    spInt->search(m_suggestion);
+    return SP_ERROR_OK;
+  }
+private:
+  CStdString m_query;
+  CStdString m_suggestion;
+};
+
+//gives the items their new thumbs on the gui thread, the items are on screen and the gui reads them while it renders
+//nothing else writes the thumbs of an item once it is made, and the snapshot takes them from libspotify, not from the items
+class SpotifyThumbsWrittenCommand : public SpotifyGuiCommand
+{
+public:
+  void Add(CFileItemPtr item, const CStdString &thumb){ m_thumbs.push_back(std::make_pair(item, thumb)); }
+  bool IsEmpty(){ return m_thumbs.empty(); }
+  virtual void Execute()
+  {
+    for (unsigned int i = 0; i < m_thumbs.size(); i++)
+      m_thumbs[i].first->SetThumbnailImage(m_thumbs[i].second);
+  }
+private:
+  std::vector<std::pair<CFileItemPtr, CStdString> > m_thumbs;
+};
+
+//asks if the user meant something else than what was searched for, from the gui thread
+class SpotifyDidYouMeanCommand : public SpotifyGuiCommand
+{
+public:
+  SpotifyDidYouMeanCommand(const CStdString &query, const CStdString &suggestion) : m_query(query), m_suggestion(suggestion) {}
+  virtual void Execute()
+  {
+    CStdString message;
+    message.Format("Did you mean %s?", m_suggestion.c_str());
+    CGUIDialogYesNo* m_yesNoDialog = (CGUIDialogYesNo*)g_windowManager.GetWindow(WINDOW_DIALOG_YES_NO);
+    m_yesNoDialog->SetHeading("Spotify");
+    m_yesNoDialog->SetLine(0, "" );
+    m_yesNoDialog->SetLine(1, message );
+    m_yesNoDialog->SetLine(2, "" );
+    m_yesNoDialog->DoModal();
+    if (!m_yesNoDialog->IsConfirmed())
+      return;
+
+    //these results are not what the user wanted, dont keep them
+    g_spotifyInterface->postCommand(new SpotifySearchAgainCommand(m_query, m_suggestion));
+  }
+private:
+  CStdString m_query;
+  CStdString m_suggestion;
+};
+
+//spotify session callbacks
+int SpotifyInterface::processEvents()
+{
+  int nextEvent = 0;
+  sp_session_process_events(m_session, &nextEvent);
+  releaseLoadedImages();
+  thumbsWritten();
+  startThumbRequests();
+  if (m_snapshotPending)
+  {
+    updateSnapshot();
+    //come back soon while the playlists are being converted, the session lock is let go in between
+    if (m_snapshotPlaylist >= 0)
+      nextEvent = 1;
+  }
+  return nextEvent;
 }
 
 void SpotifyInterface::cb_connectionError(sp_session *session, sp_error error)
@@ -78,14 +181,15 @@ void SpotifyInterface::cb_connectionError(sp_session *session, sp_error error)
   message.Format("%s",sp_error_message(error));
   CLog::Log( LOGERROR, "Spotifylog: connection to Spotify failed: %s\n", message.c_str());
   g_spotifyInterface->hideReconectingDialog();
-  g_spotifyInterface->showConnectionErrorDialog(error);
+  g_spotifyInterface->postGuiCommand(new SpotifyConnectionErrorCommand(error));
 }
 
 void SpotifyInterface::cb_loggedIn(sp_session *session, sp_error error)
 {
   if (SP_ERROR_OK != error) {
     CLog::Log( LOGERROR, "Spotifylog: failed to log in to Spotify: %s\n", sp_error_message(error));
-    g_spotifyInterface->showConnectionErrorDialog(error);
+    g_spotifyInterface->hideReconectingDialog();
+    g_spotifyInterface->postGuiCommand(new SpotifyConnectionErrorCommand(error));
     return;
   }
   sp_user *me = sp_session_user(session);
@@ -94,12 +198,20 @@ void SpotifyInterface::cb_loggedIn(sp_session *session, sp_error error)
                          sp_user_canonical_name(me));
   CLog::Log( LOGDEBUG, "Spotifylog: Logged in to Spotify as user %s\n", my_name);
   g_spotifyInterface->hideReconectingDialog();
+
+  //keep the playlist menu up to date from now on
+  g_spotifyInterface->watchPlaylists();
+
+  //the snapshot is written again when the playlists have synced
+  g_spotifyInterface->m_snapshotPending = true;
+  g_spotifyInterface->m_snapshotPlaylist = -1;
+  g_spotifyInterface->m_loginTime = CTimeUtils::GetTimeMS();
 }
 
 void SpotifyInterface::cb_notifyMainThread(sp_session *session)
 {
-  //spotify needs to advance itself, set it to do so the next tick
-  g_spotifyInterface->m_nextEvent = CTimeUtils::GetTimeMS();
+  //spotify needs to advance itself, wake up the session thread
+  g_spotifyInterface->m_sessionThread.Wake();
 }
 
 void SpotifyInterface::cb_logMessage(sp_session *session, const char *data)
@@ -107,69 +219,315 @@ void SpotifyInterface::cb_logMessage(sp_session *session, const char *data)
   CLog::Log( LOGNOTICE, "Spotifylog: %s\n", data);
 }
 
-//thumb delivery callback
+//thumb delivery callback, the image is written once for every item that waits for it
 void SpotifyInterface::cb_imageLoaded(sp_image *image, void *userdata)
 {
   if (image)
   {
-    try{
-      CFileItem *item = (CFileItem*)userdata;
-      CStdString fileName;
-      fileName.Format("%s", item->GetExtraInfo());
+    SpotifyInterface *spInt = (SpotifyInterface*)userdata;
+    CStdString fileName = spInt->m_thumbCache.GetPath(sp_image_image_id(image));
+    ThumbRequestMap::iterator it = spInt->m_thumbRequests.find(fileName);
+    if (it == spInt->m_thumbRequests.end() || it->second.image != image)
+      return;
+    it->second.image = 0;
+    it->second.isWriting = true;
+    spInt->m_loadedImages.push_back(image);
+    spInt->m_thumbsLoading--;
+
+    //the writer copies the data, the items get the thumb in thumbsWritten
+    size_t len;
+    const void *buf = sp_image_data(image, &len);
+    spInt->m_thumbWriter.Write(fileName, buf, len);
+  }
+}
 
-      //if there is a wierd name, something is wrong, or do we allready have the image, return
-      if (XFILE::CFile::Exists(fileName)) 
-      {
-        item->SetThumbnailImage(fileName);
-        return;
-      }
-      if (fileName.Left(10) != "special://")
-      {
-        return; //without a new thumb!
-      }
+void SpotifyInterface::thumbsWritten()
+{
+  std::vector<SpotifyThumbWriter::Result> results;
+  m_thumbWriter.GetResults(results);
+  SpotifyThumbsWrittenCommand *command = new SpotifyThumbsWrittenCommand();
+  for (unsigned int i = 0; i < results.size(); i++)
+  {
+    ThumbRequestMap::iterator it = m_thumbRequests.find(results[i].fileName);
+    if (it == m_thumbRequests.end())
+      continue;
+    if (results[i].isWritten)
+    {
+      m_thumbCache.Added(it->second.imageId, results[i].size);
+      for (unsigned int j = 0; j < it->second.items.size(); j++)
+        command->Add(it->second.items[j].item, results[i].fileName);
+    }
+    finishThumbRequest(it);
+  }
+  if (command->IsEmpty())
+    delete command;
+  else
+    postGuiCommand(command);
+}
 
-      CFile file;
-      if (file.OpenForWrite(fileName,true))
-      {
-        const void *buf;
-        size_t len, written;
+void SpotifyInterface::finishThumbRequest(ThumbRequestMap::iterator it)
+{
+  std::vector<ThumbWaiter> &items = it->second.items;
+  for (unsigned int i = 0; i < items.size(); i++)
+  {
+    std::vector<imageItemPair> &owner = *items[i].owner;
+    std::vector<imageItemPair>::iterator pair = std::find(owner.begin(), owner.end(), imageItemPair(it->first, items[i].item));
+    if (pair != owner.end())
+      owner.erase(pair);
+  }
+  m_thumbRequests.erase(it);
+}
 
-        buf = sp_image_data(image, &len);
-        written = file.Write(buf, len);
-        if (written != len)
-        {
-          CLog::Log( LOGERROR, "Spotifylog: error creating thumb %s", fileName.c_str());
-          file.Close();
-          file.Delete(fileName);
-        }
-        else
-        {
-          item->SetThumbnailImage(fileName);
-          file.Close();
-        }
-      }
-    }catch(...)
+void SpotifyInterface::cancelThumb(const imageItemPair &pair)
+{
+  //if it is not there the image has been loaded and is released already
+  ThumbRequestMap::iterator it = m_thumbRequests.find(pair.first);
+  if (it == m_thumbRequests.end())
+    return;
+  //the caller takes the pair out of its own list
+  std::vector<ThumbWaiter> &items = it->second.items;
+  std::vector<ThumbWaiter>::iterator item = items.begin();
+  while (item != items.end() && item->item != pair.second)
+    ++item;
+  if (item == items.end())
+    return;
+  items.erase(item);
+  //one that is being written stays until the writer is done with it
+  if (items.empty() && !it->second.isWriting)
+  {
+    //nobody wants it, stop loading it or take it out of the queue
+    if (it->second.image)
+    {
+      sp_image_remove_load_callback(it->second.image, &cb_imageLoaded, this);
+      sp_image_release(it->second.image);
+      m_thumbsLoading--;
+    }
+    m_thumbRequests.erase(it);
+    startThumbRequests();
+  }
+}
+
+void SpotifyInterface::startThumbRequests()
+{
+  while (m_thumbsLoading < g_advancedSettings.m_spotifyThumbRequests)
+  {
+    //the first one of the newest listing that is not loading
+    ThumbRequestMap::iterator next = m_thumbRequests.end();
+    for (ThumbRequestMap::iterator it = m_thumbRequests.begin(); it != m_thumbRequests.end(); ++it)
+    {
+      if (it->second.image || it->second.isWriting)
+        continue;
+      if (next == m_thumbRequests.end() || it->second.generation > next->second.generation
+        || (it->second.generation == next->second.generation && it->second.sequence < next->second.sequence))
+        next = it;
+    }
+    if (next == m_thumbRequests.end())
+      return;
+
+    sp_image *spImage = sp_image_create(m_session, (byte*)next->second.imageId);
+    if (!spImage)
     {
-      CLog::Log( LOGERROR, "Spotifylog: error creating thumb");
+      //the items keep their default thumb
+      finishThumbRequest(next);
+      continue;
     }
+    next->second.image = spImage;
+    m_thumbsLoading++;
+    sp_image_add_load_callback(spImage, &cb_imageLoaded, this);
+  }
+}
+
+void SpotifyInterface::releaseLoadedImages()
+{
+  while (!m_loadedImages.empty())
+  {
+    sp_image_remove_load_callback(m_loadedImages.back(), &cb_imageLoaded, this);
+    sp_image_release(m_loadedImages.back());
+    m_loadedImages.pop_back();
+  }
+}
+
+void SpotifyPlaylistTracks::Update()
+{
+  clear();
+  int numTracks = sp_playlist_num_tracks(m_playlist);
+  m_tracks.reserve(numTracks);
+  for (int index = 0; index < numTracks; index++)
+  {
+    sp_track *spTrack = sp_playlist_track(m_playlist, index);
+    sp_track_add_ref(spTrack);
+    m_tracks.push_back(spTrack);
   }
 }
 
+void SpotifyPlaylistTracks::clear()
+{
+  for (unsigned int i = 0; i < m_tracks.size(); i++)
+    sp_track_release(m_tracks[i]);
+  m_tracks.clear();
+}
+
 //load the tracks from a playlist
-bool SpotifyInterface::getPlaylistTracks(CFileItemList &items, int playlist)
+bool SpotifyInterface::getPlaylistTracks(CFileItemList &items, int playlist, int page)
 {
-  CLog::Log( LOGDEBUG, "Spotifylog: loading playlist: %i", playlist);
+  CLog::Log( LOGDEBUG, "Spotifylog: loading playlist: %i page: %i", playlist, page);
   sp_playlistcontainer *pc = sp_session_playlistcontainer (m_session);
   sp_playlist *pl = sp_playlistcontainer_playlist(pc, playlist);
   if (pl)
   {
-    for (int index=0; index < sp_playlist_num_tracks(pl); index++)
+    //the first page reads the playlist again, the others page through what it read
+    PlaylistTracksPtr &tracks = m_playlistTracks[playlist];
+    if (!tracks || tracks->m_playlist != pl || page == 0)
+    {
+      tracks = PlaylistTracksPtr(new SpotifyPlaylistTracks(pl));
+      tracks->Update();
+    }
+    if (page > tracks->m_lastPage)
+      tracks->m_lastPage = page;
+
+    int pageSize = g_advancedSettings.m_spotifyPlaylistPageSize;
+    int first = page * pageSize;
+    int last = first + pageSize;
+    if (last > tracks->Size())
+      last = tracks->Size();
+    for (int index=first; index < last; index++)
     {
       CFileItemPtr pItem;
-      pItem = spTrackToItem(sp_playlist_track(pl,index), PLAYLIST_TRACK, true);
+      pItem = spTrackToItem(tracks->Get(index), PLAYLIST_TRACK, true);
 //      pItem->SetContentType("audio/spotify");
       items.Add(pItem);
     }
+
+    CMediaSource share;
+    if (last < tracks->Size())
+    {
+      //the next page
+      share.strPath.Format("musicdb://spotify/tracks/playlist/%i/%i/", playlist, page + 1);
+      share.strName.Format("Next tracks, %i to %i of %i", last + 1, min(last + pageSize, tracks->Size()), tracks->Size());
+      CFileItemPtr pItem(new CFileItem(share));
+      items.Add(pItem);
+    }
+    else if (tracks->Size() > 0)
+    {
+      //add the albums of the playlist to the library
+      share.strPath.Format("musicdb://spotify/command/importplaylist/%i/", playlist);
+      share.strName.Format("Add the albums of %s to the library", sp_playlist_name(pl));
+      CFileItemPtr pItem(new CFileItem(share));
+      items.Add(pItem);
+    }
+  }
+  return true;
+}
+
+bool SpotifyInterface::getSnapshot(const CStdString &name, CFileItemList &items)
+{
+  int first = items.Size();
+  if (!m_snapshot.Get(name, items))
+    return false;
+  //the thumbs are on screen now, keep them in the cache
+  for (int i = first; i < items.Size(); i++)
+    m_thumbCache.Touch(items[i]->GetThumbnailImage());
+  return true;
+}
+
+void SpotifyInterface::updateSnapshot()
+{
+  //this runs on every turn of the session thread, dont look too often
+  unsigned int now = CTimeUtils::GetTimeMS();
+  if (m_snapshotPlaylist < 0 && now - m_snapshotCheckTime < 1000)
+    return;
+  m_snapshotCheckTime = now;
+
+  sp_playlistcontainer *pc = sp_session_playlistcontainer(m_session);
+  if (!pc)
+    return;
+  int numPlaylists = sp_playlistcontainer_num_playlists(pc);
+  //after a while we take what has loaded, a track that never loads should not keep the old lists forever
+  bool isLate = now - m_loginTime > SNAPSHOT_DEADLINE;
+
+  if (m_snapshotPlaylist < 0)
+  {
+    //wait until the playlists and all their tracks are there
+    if (numPlaylists == 0 && now - m_loginTime < 30000)
+      return;
+    if (!isLate && !isSnapshotLoaded(pc, numPlaylists))
+      return;
+    if (isLate)
+      CLog::Log(LOGDEBUG, "Spotifylog: playlists are not synced in time, updating the snapshot with what is loaded");
+    else
+      CLog::Log(LOGDEBUG, "Spotifylog: playlists are synced, updating the snapshot");
+    m_snapshotPlaylist = 0;
+    m_snapshotTrack = 0;
+    m_snapshotTracks.Clear();
+    return;
+  }
+
+  //a few tracks each turn so the session thread is not held up by a big playlist
+  if (m_snapshotPlaylist < numPlaylists)
+  {
+    //no thumbnails, they are asked for when the playlist is opened
+    //a playlist that has not loaded keeps what the snapshot had
+    sp_playlist *pl = sp_playlistcontainer_playlist(pc, m_snapshotPlaylist);
+    if (pl && sp_playlist_is_loaded(pl))
+    {
+      int last = min(m_snapshotTrack + SNAPSHOT_BATCH, sp_playlist_num_tracks(pl));
+      for (; m_snapshotTrack < last; m_snapshotTrack++)
+      {
+        sp_track *track = sp_playlist_track(pl, m_snapshotTrack);
+        if (sp_track_is_loaded(track))
+          m_snapshotTracks.Add(spTrackToItem(track, PLAYLIST_TRACK));
+      }
+      if (m_snapshotTrack < sp_playlist_num_tracks(pl))
+        return;
+      CStdString name;
+      name.Format("playlist/%i", m_snapshotPlaylist);
+      m_snapshot.Set(name, m_snapshotTracks);
+    }
+    m_snapshotTracks.Clear();
+    m_snapshotTrack = 0;
+    m_snapshotPlaylist++;
+    return;
+  }
+
+  //all done, drop the playlists that are gone, playlist/1 also removes playlist/10 but that one is gone too
+  CFileItemList oldPlaylists;
+  m_snapshot.Get("playlists", oldPlaylists);
+  for (int i = numPlaylists; i < oldPlaylists.Size(); i++)
+  {
+    CStdString name;
+    name.Format("playlist/%i", i);
+    m_snapshot.Remove(name);
+  }
+  //made again from libspotify, the items of the playlist menu may be getting their thumbs on the gui thread
+  CFileItemList playlists;
+  for (int i = 0; i < numPlaylists; i++)
+  {
+    sp_playlist *pl = sp_playlistcontainer_playlist(pc, i);
+    if (pl)
+      playlists.Add(spPlaylistToItem(pl, i, false));
+  }
+  m_snapshot.Set("playlists", playlists);
+  m_snapshot.Save();
+  m_snapshotPending = false;
+  m_snapshotPlaylist = -1;
+
+  CGUIMessage message(GUI_MSG_NOTIFY_ALL, 0, 0, GUI_MSG_UPDATE_PATH);
+  message.SetStringParam("musicdb://spotify/menu/playlists/");
+  g_windowManager.SendThreadMessage(message);
+}
+
+bool SpotifyInterface::isSnapshotLoaded(sp_playlistcontainer *pc, int numPlaylists)
+{
+  for (int i = 0; i < numPlaylists; i++)
+  {
+    sp_playlist *pl = sp_playlistcontainer_playlist(pc, i);
+    if (!pl || !sp_playlist_is_loaded(pl))
+      return false;
+    for (int index = 0; index < sp_playlist_num_tracks(pl); index++)
+    {
+      if (!sp_track_is_loaded(sp_playlist_track(pl, index)))
+        return false;
+    }
   }
   return true;
 }
@@ -178,29 +536,40 @@ bool SpotifyInterface::getPlaylistTracks(CFileItemList &items, int playlist)
 void SpotifyInterface::cb_albumBrowseComplete(sp_albumbrowse *result, void *userdata)
 {
   SpotifyInterface *spInt = g_spotifyInterface;
-  if (result && SP_ERROR_OK == sp_albumbrowse_error(result) && sp_albumbrowse_num_tracks > 0)
+
+  //find the album it belongs to, it might have been thrown out of the cache already
+  SpotifyAlbumBrowse *entry = 0;
+  for (AlbumBrowseCache::iterator it = spInt->m_albumBrowseCache.Begin(); it != spInt->m_albumBrowseCache.End(); ++it)
+  {
+    if (it->second->m_browse == result)
+      entry = it->second.get();
+  }
+  if (!entry)
+  {
+    CLog::Log( LOGDEBUG, "Spotifylog: albumbrowse result for an album we dont have anymore");
+    spInt->hideProgressDialog();
+    return;
+  }
+
+  if (result && SP_ERROR_OK == sp_albumbrowse_error(result) && sp_albumbrowse_num_tracks(result) > 0)
   {
-    spInt->m_progressDialog->SetPercentage(50);
-    spInt->m_progressDialog->Progress();
+    spInt->setProgress(50);
 
     //the first track, load it with thumbnail
     CFileItemPtr pItem;
     pItem = spInt->spTrackToItem(sp_albumbrowse_track(result, 0), ALBUMBROWSE_TRACK, true);
 //    pItem->SetContentType("audio/spotify");
-    spInt->m_browseAlbumVector.Add(pItem);
+    entry->m_tracks.Add(pItem);
 
     CStdString oldThumb = pItem->GetExtraInfo();
     CStdString newThumb;
     newThumb.Format("%s%s", spInt->m_currentPlayingDir, CUtil::GetFileName(oldThumb));
-    CPicture::CacheThumb(oldThumb ,newThumb);
+    spInt->m_thumbWriter.Copy(oldThumb ,newThumb);
     pItem->SetThumbnailImage(newThumb);
 
     //add the "add to library" item
-    CMusicDatabase *musicdatabase = new CMusicDatabase;
-    musicdatabase->Open();
     MUSIC_INFO::CMusicInfoTag *tag = pItem->GetMusicInfoTag();
-    int albumId = musicdatabase->GetAlbumByName(tag->GetAlbum());
-    if (albumId == -1)
+    if (!spInt->m_albumIndex.Find(tag->GetAlbum(), tag->GetAlbumArtist()))
     {
       CAlbum album;
       album.iYear = tag->GetYear();
@@ -211,12 +580,9 @@ void SpotifyInterface::cb_albumBrowseComplete(sp_albumbrowse *result, void *user
       pItem3->m_strTitle = "Add album to library";
       pItem3->SetLabel("Add album to library");
       pItem3->SetThumbnailImage(pItem->GetThumbnailImage());
-      spInt->m_browseAlbumVector.Add(pItem3);
+      entry->m_tracks.Add(pItem3);
     }
 
-    musicdatabase->Close();
-    delete musicdatabase;
-
     //the rest of the tracks
     for (int index=1; index < sp_albumbrowse_num_tracks(result); index++)
     {
@@ -224,27 +590,37 @@ void SpotifyInterface::cb_albumBrowseComplete(sp_albumbrowse *result, void *user
       pItem2 = spInt->spTrackToItem(sp_albumbrowse_track(result, index), ALBUMBROWSE_TRACK, true);
 //      pItem2->SetContentType("audio/spotify");
       pItem2->SetThumbnailImage(newThumb);
-      spInt->m_browseAlbumVector.Add(pItem2);
+      entry->m_tracks.Add(pItem2);
     }
 
-    CGUIMessage message(GUI_MSG_NOTIFY_ALL, 0, 0, GUI_MSG_UPDATE_PATH);
+    entry->m_isLoaded = true;
     CStdString dir;
-    dir.Format("%s",spInt->m_albumBrowseStr);
+    dir.Format("%s",entry->m_path);
+    spInt->m_albumBrowseCache.Trim();
+
+    CGUIMessage message(GUI_MSG_NOTIFY_ALL, 0, 0, GUI_MSG_UPDATE_PATH);
     message.SetStringParam(dir);
     g_windowManager.SendThreadMessage(message);
   }
   else
+  {
     CLog::Log( LOGERROR, "Spotifylog: browse failed!");
+    CURL url(entry->m_path);
+    spInt->m_albumBrowseCache.Remove(url.GetFileNameWithoutPath());
+  }
   spInt->hideProgressDialog();
 }
 
 void SpotifyInterface::cb_topListAritstsComplete(sp_toplistbrowse *result, void *userdata)
 {
   SpotifyInterface *spInt = g_spotifyInterface;
+  //userdata is set when the getter opened the progress dialog, else the snapshot is on screen
+  bool showsDialog = userdata != 0;
   if (result && SP_ERROR_OK == sp_toplistbrowse_error(result))
   {
-    spInt->m_progressDialog->SetPercentage(50);
-    spInt->m_progressDialog->Progress();
+    spInt->m_browseToplistArtistsVector.Clear();
+    if (showsDialog)
+      spInt->setProgress(50);
     for (int index=0; index < sp_toplistbrowse_num_artists(result); index++)
     {
       CFileItemPtr pItem;
@@ -264,8 +640,11 @@ void SpotifyInterface::cb_topListAritstsComplete(sp_toplistbrowse *result, void
       spInt->m_browseToplistArtistsVector.Add(pItem);
     }
 
-    spInt->m_progressDialog->SetPercentage(99);
-    spInt->m_progressDialog->Progress();
+    spInt->m_snapshot.Set("toplist/artists", spInt->m_browseToplistArtistsVector);
+    spInt->m_snapshot.Save();
+
+    if (showsDialog)
+      spInt->setProgress(99);
     CGUIMessage message(GUI_MSG_NOTIFY_ALL, 0, 0, GUI_MSG_UPDATE_PATH);
     CStdString dir;
     dir.Format("musicdb://spotify/artists/toplist/");
@@ -273,20 +652,30 @@ void SpotifyInterface::cb_topListAritstsComplete(sp_toplistbrowse *result, void
     g_windowManager.SendThreadMessage(message);
   }
   else
+  {
     CLog::Log( LOGERROR, "Spotifylog: toplistartist failed!");
-  spInt->hideProgressDialog();
+    //try again the next time the toplist is opened
+    if (result && spInt->m_toplistArtistsBrowse == result)
+    {
+      sp_toplistbrowse_release(result);
+      spInt->m_toplistArtistsBrowse = 0;
+    }
+  }
+  if (showsDialog)
+    spInt->hideProgressDialog();
 }
 
 void SpotifyInterface::cb_topListAlbumsComplete(sp_toplistbrowse *result, void *userdata)
 {
   SpotifyInterface *spInt = g_spotifyInterface;
+  //userdata is set when the getter opened the progress dialog, else the snapshot is on screen
+  bool showsDialog = userdata != 0;
   if (result && SP_ERROR_OK == sp_toplistbrowse_error(result))
   {
-    spInt->m_progressDialog->SetPercentage(50);
-    spInt->m_progressDialog->Progress();
+    spInt->m_browseToplistAlbumVector.Clear();
+    if (showsDialog)
+      spInt->setProgress(50);
 
-    CMusicDatabase *musicdatabase = new CMusicDatabase;
-    musicdatabase->Open();
     int updateProgressWhen = sp_toplistbrowse_num_albums(result) / 10;
     int progress = 50;
     int progressCounter = 0;
@@ -298,41 +687,22 @@ void SpotifyInterface::cb_topListAlbumsComplete(sp_toplistbrowse *result, void *
       {
         sp_artist *spArtist = sp_album_artist(spAlbum);
 
-        //is the album in our database?
-        int albumId = musicdatabase->GetAlbumByName(sp_album_name(spAlbum), sp_artist_name(spArtist));
-        if (albumId != -1)
-        {
-          CStdString path;
-          CAlbum album;
-          path.Format("musicdb://3/%ld/",albumId);
-          musicdatabase->GetAlbumInfo(albumId, album, NULL);
-          CStdString thumb ="";
-          CFileItemPtr pItem(new CFileItem(path, album));
-          musicdatabase->GetAlbumThumb(albumId, thumb);
-          if (thumb != "NONE")
-            pItem->SetThumbnailImage(thumb);
-          else
-            pItem->SetThumbnailImage("DefaultMusicAlbums.png");
-          spInt->m_browseArtistAlbumVector.Add(pItem);
-        }else
-        {
-          CFileItemPtr pItem;
+        //is the album in our library?
+        CFileItemPtr pItem = spInt->m_albumIndex.Find(sp_album_name(spAlbum), sp_artist_name(spArtist));
+        if (!pItem)
           pItem = spInt->spAlbumToItem(spAlbum, TOPLIST_ALBUM);
-//          pItem->SetContentType("audio/spotify");
-          spInt->m_browseToplistAlbumVector.Add(pItem);
-        }
+        spInt->m_browseToplistAlbumVector.Add(pItem);
 
         //set the progressbar
         if (progressCounter++ >= updateProgressWhen)
         {
           progressCounter = 0;
           progress +=5;
-          spInt->m_progressDialog->SetPercentage(progress);
-          spInt->m_progressDialog->Progress();
+          if (showsDialog)
+            spInt->setProgress(progress);
         }
       }
     }
-    delete musicdatabase;
 
     //if the result is empty, add a note
     if (sp_toplistbrowse_num_albums(result) < 1)
@@ -345,8 +715,11 @@ void SpotifyInterface::cb_topListAlbumsComplete(sp_toplistbrowse *result, void *
       spInt->m_browseToplistAlbumVector.Add(pItem);
     }
 
-    spInt->m_progressDialog->SetPercentage(99);
-    spInt->m_progressDialog->Progress();
+    spInt->m_snapshot.Set("toplist/albums", spInt->m_browseToplistAlbumVector);
+    spInt->m_snapshot.Save();
+
+    if (showsDialog)
+      spInt->setProgress(99);
     CGUIMessage message(GUI_MSG_NOTIFY_ALL, 0, 0, GUI_MSG_UPDATE_PATH);
     CStdString dir;
     dir.Format("musicdb://spotify/albums/toplist/");
@@ -354,17 +727,29 @@ void SpotifyInterface::cb_topListAlbumsComplete(sp_toplistbrowse *result, void *
     g_windowManager.SendThreadMessage(message);
   }
   else
+  {
     CLog::Log( LOGERROR, "Spotifylog: toplist album failed!");
-  spInt->hideProgressDialog();
+    //try again the next time the toplist is opened
+    if (result && spInt->m_toplistAlbumsBrowse == result)
+    {
+      sp_toplistbrowse_release(result);
+      spInt->m_toplistAlbumsBrowse = 0;
+    }
+  }
+  if (showsDialog)
+    spInt->hideProgressDialog();
 }
 
 void SpotifyInterface::cb_topListTracksComplete(sp_toplistbrowse *result, void *userdata)
 {
   SpotifyInterface *spInt = g_spotifyInterface;
+  //userdata is set when the getter opened the progress dialog, else the snapshot is on screen
+  bool showsDialog = userdata != 0;
   if (result && SP_ERROR_OK == sp_toplistbrowse_error(result))
   {
-    spInt->m_progressDialog->SetPercentage(50);
-    spInt->m_progressDialog->Progress();
+    spInt->m_browseToplistTracksVector.Clear();
+    if (showsDialog)
+      spInt->setProgress(50);
 
     for (int index=0; index < sp_toplistbrowse_num_tracks(result); index++)
     {
@@ -389,8 +774,11 @@ void SpotifyInterface::cb_topListTracksComplete(sp_toplistbrowse *result, void *
       spInt->m_browseToplistTracksVector.Add(pItem);
     }
 
-    spInt->m_progressDialog->SetPercentage(99);
-    spInt->m_progressDialog->Progress();
+    spInt->m_snapshot.Set("toplist/tracks", spInt->m_browseToplistTracksVector);
+    spInt->m_snapshot.Save();
+
+    if (showsDialog)
+      spInt->setProgress(99);
     CGUIMessage message(GUI_MSG_NOTIFY_ALL, 0, 0, GUI_MSG_UPDATE_PATH);
     CStdString dir;
     dir.Format("musicdb://spotify/tracks/toplist/");
@@ -398,25 +786,47 @@ void SpotifyInterface::cb_topListTracksComplete(sp_toplistbrowse *result, void *
     g_windowManager.SendThreadMessage(message);
   }
   else
+  {
     CLog::Log( LOGERROR, "Spotifylog: toplist track failed!");
-  spInt->hideProgressDialog();
+    //try again the next time the toplist is opened
+    if (result && spInt->m_toplistTracksBrowse == result)
+    {
+      sp_toplistbrowse_release(result);
+      spInt->m_toplistTracksBrowse = 0;
+    }
+  }
+  if (showsDialog)
+    spInt->hideProgressDialog();
 }
 
 void SpotifyInterface::cb_artistBrowseComplete(sp_artistbrowse *result, void *userdata)
 {
   SpotifyInterface *spInt = g_spotifyInterface;
+
+  //find the artist it belongs to, it might have been thrown out of the cache already
+  SpotifyArtistBrowse *entry = 0;
+  for (ArtistBrowseCache::iterator it = spInt->m_artistBrowseCache.Begin(); it != spInt->m_artistBrowseCache.End(); ++it)
+  {
+    if (it->second->m_browse == result)
+      entry = it->second.get();
+  }
+  if (!entry)
+  {
+    CLog::Log( LOGDEBUG, "Spotifylog: artistbrowse result for an artist we dont have anymore");
+    spInt->hideProgressDialog();
+    return;
+  }
+
   if (result && SP_ERROR_OK == sp_artistbrowse_error(result))
   {
-    spInt->m_progressDialog->SetPercentage(50);
-    spInt->m_progressDialog->Progress();
+    spInt->setProgress(50);
     CLog::Log( LOGDEBUG, "Spotifylog: artistbrowse results are done!");
     //sp_album *tempalbum = 0;
 
-    CMusicDatabase *musicdatabase = new CMusicDatabase;
-    musicdatabase->Open();
     int updateProgressWhen = sp_artistbrowse_num_albums(result) / 10;
     int progress = 50;
     int progressCounter = 0;
+    spInt->m_thumbArtistBrowse = entry;
 
     //if you are using spotifylib (not openspotifylib) 0.0.3, use the iterate over the tracks instead
     //  for (int index=0; index < sp_artistbrowse_num_tracks(result); index++)
@@ -432,43 +842,23 @@ void SpotifyInterface::cb_artistBrowseComplete(sp_artistbrowse *result, void *us
       {
         sp_artist *spArtist = sp_album_artist(spAlbum);
 
-        //is the album in our database?
-        int albumId = musicdatabase->GetAlbumByName(sp_album_name(spAlbum), sp_artist_name(spArtist));
-        if (albumId != -1)
-        {
-          CStdString path;
-          CAlbum album;
-          path.Format("musicdb://3/%ld/",albumId);
-          musicdatabase->GetAlbumInfo(albumId, album, NULL);
-          CStdString thumb ="";
-          CFileItemPtr pItem(new CFileItem(path, album));
-          musicdatabase->GetAlbumThumb(albumId, thumb);
-          if (thumb != "NONE")
-            pItem->SetThumbnailImage(thumb);
-          else
-            pItem->SetThumbnailImage("DefaultMusicAlbums.png");
-          spInt->m_browseArtistAlbumVector.Add(pItem);
-        }else
-        {
-          CFileItemPtr pItem;
+        //is the album in our library?
+        CFileItemPtr pItem = spInt->m_albumIndex.Find(sp_album_name(spAlbum), sp_artist_name(spArtist));
+        if (!pItem)
           pItem = spInt->spAlbumToItem(spAlbum, ARTISTBROWSE_ALBUM);
-//          pItem->SetContentType("spotify artistbrowse album");
-          spInt->m_browseArtistAlbumVector.Add(pItem);
-        }
+        entry->m_albums.Add(pItem);
 
         //set the progressbar
         if (progressCounter++ >= updateProgressWhen)
         {
           progressCounter = 0;
           progress +=5;
-          spInt->m_progressDialog->SetPercentage(progress);
-          spInt->m_progressDialog->Progress();
+          spInt->setProgress(progress);
         }
       }
     }
-    delete musicdatabase;
-    spInt->m_progressDialog->SetPercentage(99);
-    spInt->m_progressDialog->Progress();
+    spInt->m_thumbArtistBrowse = 0;
+    spInt->setProgress(99);
 
     //get the similar artists
     for (int index=0; index < sp_artistbrowse_num_similar_artists(result); index++)
@@ -476,7 +866,7 @@ void SpotifyInterface::cb_artistBrowseComplete(sp_artistbrowse *result, void *us
       CFileItemPtr pItem;
       pItem = spInt->spArtistToItem(sp_artistbrowse_similar_artist(result, index));
 //      pItem->SetContentType("spotify artistbrowse similar artist");
-      spInt->m_browseArtistSimilarArtistsVector.Add(pItem);
+      entry->m_similarArtists.Add(pItem);
     }
 
     //menu
@@ -489,28 +879,28 @@ void SpotifyInterface::cb_artistBrowseComplete(sp_artistbrowse *result, void *us
     //artistUri.Format("%s", spotify_artist_uri);
 
     CMediaSource share;
-    CURL url(spInt->m_artistBrowseStr);
+    CURL url(entry->m_path);
     CStdString uri = url.GetFileNameWithoutPath();
 
     //albums
-    if (!spInt->m_browseArtistAlbumVector.IsEmpty())
+    if (!entry->m_albums.IsEmpty())
     {
       share.strPath.Format("musicdb://spotify/albums/artistbrowse/%s/",uri.c_str());
-      share.strName.Format("%s, %i albums",sp_artist_name(spArtist), spInt->m_browseArtistAlbumVector.Size());
+      share.strName.Format("%s, %i albums",sp_artist_name(spArtist), entry->m_albums.Size());
     }else
     {
-      share.strPath.Format("musicdb://spotify/menu/artisbrowse/%s/",spInt->m_artistBrowseStr);
+      share.strPath.Format("musicdb://spotify/menu/artisbrowse/%s/",entry->m_path);
       share.strName.Format("%s, No albums found",sp_artist_name(spArtist));
     }
     CFileItemPtr pItem3(new CFileItem(share));
     pItem3->SetThumbnailImage(thumb);
-    spInt->m_browseArtistMenuVector.Add(pItem3);
+    entry->m_menu.Add(pItem3);
 
     //similar artists
-    if (!spInt->m_browseArtistSimilarArtistsVector.IsEmpty())
+    if (!entry->m_similarArtists.IsEmpty())
     {
       share.strPath.Format("musicdb://spotify/artists/artistbrowse/%s/",uri.c_str());
-      share.strName.Format("%s, %i similar artists",sp_artist_name(spArtist), spInt->m_browseArtistSimilarArtistsVector.Size());
+      share.strName.Format("%s, %i similar artists",sp_artist_name(spArtist), entry->m_similarArtists.Size());
     }else
     {
       share.strPath.Format("musicdb://spotify/menu/artisbrowse/%s/",uri.c_str());
@@ -518,7 +908,17 @@ void SpotifyInterface::cb_artistBrowseComplete(sp_artistbrowse *result, void *us
     }
     CFileItemPtr pItem4(new CFileItem(share));
     pItem4->SetThumbnailImage(thumb);
-    spInt->m_browseArtistMenuVector.Add(pItem4);
+    entry->m_menu.Add(pItem4);
+
+    //add all of the albums to the library
+    if (!entry->m_albums.IsEmpty())
+    {
+      share.strPath.Format("musicdb://spotify/command/importartist/%s/",uri.c_str());
+      share.strName.Format("Add the albums of %s to the library",sp_artist_name(spArtist));
+      CFileItemPtr pItem5(new CFileItem(share));
+      pItem5->SetThumbnailImage(thumb);
+      entry->m_menu.Add(pItem5);
+    }
     //get some portrait images
 
     if (sp_artistbrowse_num_portraits(result) > 0)
@@ -527,20 +927,48 @@ void SpotifyInterface::cb_artistBrowseComplete(sp_artistbrowse *result, void *us
       //    spInt->requestThumb((unsigned char*)sp_artistbrowse_portrait(result,0),artistUri,pItem4, ARTISTBROWSE_ARTIST);
     }
 
-    CGUIMessage message(GUI_MSG_NOTIFY_ALL, 0, 0, GUI_MSG_UPDATE_PATH);
+    entry->m_isLoaded = true;
     CStdString dir;
-    dir.Format("%s",spInt->m_artistBrowseStr);
+    dir.Format("%s",entry->m_path);
+
+    //it is bigger now, it might push older artists out
+    spInt->m_artistBrowseCache.Trim();
+
+    CGUIMessage message(GUI_MSG_NOTIFY_ALL, 0, 0, GUI_MSG_UPDATE_PATH);
     message.SetStringParam(dir);
     g_windowManager.SendThreadMessage(message);
   }
   else
+  {
     CLog::Log( LOGERROR, "Spotifylog: artistbrowse failed!");
+    //dont keep the failure around, try again the next time
+    CURL url(entry->m_path);
+    spInt->m_artistBrowseCache.Remove(url.GetFileNameWithoutPath());
+  }
   spInt->hideProgressDialog();
 }
 
 void SpotifyInterface::cb_searchComplete(sp_search *search, void *userdata)
 {
   SpotifyInterface *spInt = g_spotifyInterface;
+
+  //find the entry, hold on to it since the lock is let go while the user answers
+  SearchPtr entry;
+  for (SearchCache::iterator it = spInt->m_searchCache.Begin(); it != spInt->m_searchCache.End(); ++it)
+  {
+    if (it->second->m_search == search)
+    {
+      entry = it->second;
+      break;
+    }
+  }
+  if (!entry)
+  {
+    //it was thrown out of the cache while we were waiting
+    CLog::Log( LOGDEBUG, "Spotifylog: search results for a search that is gone");
+    return;
+  }
+
   if (search && SP_ERROR_OK == sp_search_error(search))
   {
     CLog::Log( LOGNOTICE, "Spotifylog: search results are done!");
@@ -548,128 +976,152 @@ void SpotifyInterface::cb_searchComplete(sp_search *search, void *userdata)
     //did you misspell?
     CStdString newSearch;
     newSearch.Format("%s", sp_search_did_you_mean(search));
+    //the results are shown anyway, the gui thread asks if the user wants the other search instead
     if (newSearch !="")
-    {
-      spInt->hideProgressDialog();
-      CStdString message;
-      message.Format("Did you mean %s?",newSearch.c_str());
-      CGUIDialogYesNo* m_yesNoDialog = (CGUIDialogYesNo*)g_windowManager.GetWindow(WINDOW_DIALOG_YES_NO);
-      m_yesNoDialog->SetHeading("Spotify");
-      m_yesNoDialog->SetLine(0, "" );
-      m_yesNoDialog->SetLine(1, message );
-      m_yesNoDialog->SetLine(2, "" );
-      m_yesNoDialog->DoModal();
-      if (m_yesNoDialog->IsConfirmed())
-      {
-        spInt->search(newSearch);
-        return;
-      }
-      else
-      {
-        CStdString message;
-        message.Format("Searching for %s", spInt->m_searchStr);
-        spInt->showProgressDialog(message);
-        spInt->m_progressDialog->SetPercentage(50);
-        spInt->m_progressDialog->Progress();
-      }
-    }
+      spInt->postGuiCommand(new SpotifyDidYouMeanCommand(entry->m_query, newSearch));
 
-    spInt->m_progressDialog->SetPercentage(50);
-    spInt->m_progressDialog->Progress();
+    spInt->setProgress(50);
 
-    //get the artists
-    for (int index=0; index < sp_search_num_artists(search); index++)
-    {
-      CFileItemPtr pItem;
-      pItem = spInt->spArtistToItem(sp_search_artist(search, index));
-//      pItem->SetContentType("spotify search artist");
-      spInt->m_searchArtistVector.Add(pItem);
-    }
-    spInt->m_progressDialog->SetPercentage(60);
-    spInt->m_progressDialog->Progress();
+    spInt->m_thumbSearch = entry.get();
+    spInt->addSearchResults(entry.get(), search, true, true, true);
+    spInt->m_thumbSearch = 0;
 
-    //albums
-    CMusicDatabase *musicdatabase = new CMusicDatabase;
-    musicdatabase->Open();
-    for (int index=0; index < sp_search_num_albums(search); index++)
-    {
-      sp_album *spAlbum = sp_search_album(search,index);
-      if ( sp_album_is_available(spAlbum))
-      {
-        sp_artist *spArtist = sp_album_artist(spAlbum);
-        //is the album in our database?
-        int albumId = musicdatabase->GetAlbumByName(sp_album_name(spAlbum), sp_artist_name(spArtist));
-        if (albumId != -1)
-        {
-          CStdString path;
-          CAlbum album;
-          path.Format("musicdb://3/%ld/",albumId);
-          musicdatabase->GetAlbumInfo(albumId, album, NULL);
-          CStdString thumb ="";
-          CFileItemPtr pItem(new CFileItem(path, album));
-          musicdatabase->GetAlbumThumb(albumId, thumb);
-          if (thumb != "NONE")
-            pItem->SetThumbnailImage(thumb);
-          else
-            pItem->SetThumbnailImage("DefaultMusicAlbums.png");
-          spInt->m_searchAlbumVector.Add(pItem);
-        }else
-        {
-          CFileItemPtr pItem;
-          pItem = spInt->spAlbumToItem(spAlbum, SEARCH_ALBUM);
-//          pItem->SetContentType("spotify search album");
-         
-          spInt->m_searchAlbumVector.Add(pItem);
-        }
-      }
-    }
-    delete musicdatabase;
+    spInt->setProgress(99);
+    entry->m_isLoaded = true;
+    entry->m_time = time(NULL);
+    spInt->m_searchCache.Trim();
+
+    CGUIMessage message(GUI_MSG_NOTIFY_ALL, 0, 0, GUI_MSG_UPDATE_PATH);
+    message.SetStringParam("musicdb://spotify/menu/search/");
+    g_windowManager.SendThreadMessage(message);
 
-    spInt->m_progressDialog->SetPercentage(80);
-    spInt->m_progressDialog->Progress();
+  }else
+  {
+    CLog::Log( LOGERROR, "Spotifylog: search failed!");
+    //dont keep the failure around, try again the next time
+    spInt->m_searchCache.Remove(spInt->getSearchKey(entry->m_query));
+    if (spInt->m_currentSearch == entry)
+      spInt->m_currentSearch.reset();
+  }
+  spInt->hideProgressDialog();
+}
 
-    //tracks
-    for (int index=0; index < sp_search_num_tracks(search); index++)
+void SpotifyInterface::cb_searchPageComplete(sp_search *search, void *userdata)
+{
+  SpotifyInterface *spInt = g_spotifyInterface;
+  SearchPtr entry;
+  for (SearchCache::iterator it = spInt->m_searchCache.Begin(); it != spInt->m_searchCache.End(); ++it)
+  {
+    if (it->second->m_pageSearch == search)
     {
-      sp_track *spTrack = sp_search_track(search,index);
-      if ( sp_track_is_available(spTrack))
-      {
-        CFileItemPtr pItem;
-        pItem = spInt->spTrackToItem(spTrack,SEARCH_TRACK,true);
-//        pItem->SetContentType("audio/spotify");
-        spInt->m_searchTrackVector.Add(pItem);
-      }
+      entry = it->second;
+      break;
     }
+  }
+  if (!entry)
+  {
+    CLog::Log( LOGDEBUG, "Spotifylog: search page for a search that is gone");
+    return;
+  }
 
-    spInt->m_progressDialog->SetPercentage(99);
-    spInt->m_progressDialog->Progress();
-    spInt->m_isSearching = false;
+  entry->m_pageSearch = 0;
+  if (search && SP_ERROR_OK == sp_search_error(search))
+  {
+    CLog::Log( LOGDEBUG, "Spotifylog: more %s for %s", entry->m_pageKind.c_str(), entry->m_query.c_str());
+    spInt->m_thumbSearch = entry.get();
+    spInt->addSearchResults(entry.get(), search, entry->m_pageKind == "artists", entry->m_pageKind == "albums", entry->m_pageKind == "tracks");
+    spInt->m_thumbSearch = 0;
+    //the items point into it, keep it as long as the entry
+    entry->m_pages.push_back(search);
+    spInt->m_searchCache.Trim();
 
+    CStdString path;
+    path.Format("musicdb://spotify/%s/search/", entry->m_pageKind.c_str());
     CGUIMessage message(GUI_MSG_NOTIFY_ALL, 0, 0, GUI_MSG_UPDATE_PATH);
-    message.SetStringParam("musicdb://spotify/menu/search/");
+    message.SetStringParam(path);
     g_windowManager.SendThreadMessage(message);
-
   }else
-    CLog::Log( LOGERROR, "Spotifylog: search failed!");
+  {
+    CLog::Log( LOGERROR, "Spotifylog: search page failed!");
+    sp_search_release(search);
+  }
   spInt->hideProgressDialog();
 }
 
-SpotifyInterface::SpotifyInterface()
+SpotifyArtistBrowse::~SpotifyArtistBrowse()
 {
-  m_session = 0;
-  m_nextEvent = CTimeUtils::GetTimeMS();
-  m_showDisclaimer = true;
-  m_isShowingReconnect = false;
-  m_searchStr = "";
-  m_search = 0;
-  m_artistBrowse = 0;
-  m_albumBrowse = 0;
-  m_toplistArtistsBrowse = 0;
-  m_toplistAlbumsBrowse = 0;
-  m_toplistTracksBrowse = 0;
-  m_isSearching = false;
-
-  m_callbacks.connection_error = &cb_connectionError;
+  //stop the thumb downloading and release the images
+  while (!m_waitingThumbs.empty())
+  {
+    g_spotifyInterface->cancelThumb(m_waitingThumbs.back());
+    m_waitingThumbs.pop_back();
+  }
+  if (m_browse)
+    sp_artistbrowse_release(m_browse);
+}
+
+SpotifyAlbumBrowse::~SpotifyAlbumBrowse()
+{
+  if (m_browse)
+    sp_albumbrowse_release(m_browse);
+}
+
+SpotifySearch::~SpotifySearch()
+{
+  //stop the thumb downloading and release the images
+  while (!m_waitingThumbs.empty())
+  {
+    g_spotifyInterface->cancelThumb(m_waitingThumbs.back());
+    m_waitingThumbs.pop_back();
+  }
+  if (m_search)
+    sp_search_release(m_search);
+  if (m_pageSearch)
+    sp_search_release(m_pageSearch);
+  while (!m_pages.empty())
+  {
+    sp_search_release(m_pages.back());
+    m_pages.pop_back();
+  }
+}
+
+SpotifyInterface::SpotifyInterface()
+  : m_thumbWriter(m_sessionThread)
+{
+  m_session = 0;
+  m_showDisclaimer = true;
+  m_isShowingReconnect = false;
+  m_thumbSearch = 0;
+  m_nextSearchId = 0;
+  //the three caches share the memory setting, a third each
+  size_t cacheMemory = (size_t)g_advancedSettings.m_spotifyBrowseCacheMemory * 1024 * 1024 / 3;
+  m_searchCache.SetLimits(g_advancedSettings.m_spotifySearchCache, cacheMemory);
+  m_thumbArtistBrowse = 0;
+  m_artistBrowseCache.SetLimits(g_advancedSettings.m_spotifyArtistBrowseCache, cacheMemory);
+  m_albumBrowseCache.SetLimits(g_advancedSettings.m_spotifyAlbumBrowseCache, cacheMemory);
+  m_toplistArtistsBrowse = 0;
+  m_toplistAlbumsBrowse = 0;
+  m_toplistTracksBrowse = 0;
+  m_snapshotPending = false;
+  m_snapshotPlaylist = -1;
+  m_snapshotTrack = 0;
+  m_loginTime = 0;
+  m_snapshotCheckTime = 0;
+  m_snapshot.Load();
+  m_snapshot.Start();
+  m_import = 0;
+  m_watchedContainer = 0;
+  m_thumbsLoading = 0;
+  m_thumbGeneration = 0;
+  m_thumbSequence = 0;
+  m_progressDialog = (CGUIDialogProgress*)g_windowManager.GetWindow(WINDOW_DIALOG_PROGRESS);
+  m_isShowingProgress = false;
+  m_isProcessingGui = false;
+  m_progressWanted = false;
+  m_progressChanged = false;
+  m_progressPercentage = 0;
+
+  m_callbacks.connection_error = &cb_connectionError;
   m_callbacks.logged_out = 0;
   m_callbacks.message_to_user = 0;
   m_callbacks.logged_in = &cb_loggedIn;
@@ -680,24 +1132,38 @@ SpotifyInterface::SpotifyInterface()
   m_callbacks.log_message = &cb_logMessage;
   m_callbacks.end_of_track = &SpotifyCodec::cb_endOfTrack;
 
-  m_thumbDir.Format("special://temp/spotify/thumbs/");
-  m_playlistsThumbDir.Format("special://temp/spotify/playlistthumbs/");
-  m_toplistsThumbDir.Format("special://temp/spotify/toplistthumbs/");
   m_currentPlayingDir.Format("special://temp/spotify/currentplayingthumbs/");
 
-  //create a temp dir for the thumbnails
+  //create a temp dir for the thumbnail of the playing track, the others are kept in the thumb cache
   CDirectory::Create("special://temp/spotify/");
+  m_thumbCache.Load();
+  m_thumbWriter.Start();
+  m_albumIndex.Start();
   clean();
 }
 
 SpotifyInterface::~SpotifyInterface()
 {
-  clean();
-  disconnect();
-
+  {
+    CSingleLock lock(getSessionLock());
+    delete m_import;
+    m_import = 0;
+    clean();
+    m_thumbWriter.Stop();
+    m_albumIndex.Stop();
+    m_snapshot.Stop();
+    thumbsWritten();
+    releaseLoadedImages();
+    m_thumbCache.Save();
+    //the table holds references, they go before the session does
+    m_uris.LogStats();
+    m_uris.Clear();
+    disconnect();
+  }
+  m_sessionThread.Stop();
 }
 
-bool SpotifyInterface::connect(bool forceNewUser)
+bool SpotifyInterface::connect(bool forceNewUser, const CStdString &username, const CStdString &password)
 {
   //clean();
   //do we need to create a new session
@@ -734,13 +1200,22 @@ bool SpotifyInterface::connect(bool forceNewUser)
       m_session = NULL;
       return false;
     }
+    m_sessionThread.Start(m_session);
   }
 
+  CSingleLock lock(getSessionLock());
+
   if (forceNewUser)
   {
+    unwatchPlaylists();
+    m_uris.Clear();
     disconnect();
-    g_advancedSettings.m_spotifyUsername = "";
-    g_advancedSettings.m_spotifyPassword = "";
+    //empty ones are asked for when we log in
+    g_advancedSettings.m_spotifyUsername = username;
+    g_advancedSettings.m_spotifyPassword = password;
+    //the lists in the snapshot belong to the old user
+    m_snapshot.Clear();
+    m_snapshot.Save();
   }
   //are we logged in?
   if (sp_session_connectionstate(m_session) != SP_CONNECTION_STATE_LOGGED_IN || forceNewUser)
@@ -779,8 +1254,7 @@ bool SpotifyInterface::reconnect(bool forceNewUser)
     {
       showReconectingDialog();
       connect(forceNewUser);
-      m_nextEvent = CTimeUtils::GetTimeMS();
-      processEvents();
+      m_sessionThread.Wake();
       return false;
     }
     return true;
@@ -790,10 +1264,10 @@ bool SpotifyInterface::reconnect(bool forceNewUser)
 
 void SpotifyInterface::clean()
 {
-  clean(true,true,true,true,true,true,true,true,true);
+  clean(true,true,true,true,true,true);
 }
 
-void SpotifyInterface::clean(bool search, bool artistbrowse, bool albumbrowse, bool playlists, bool toplists, bool searchthumbs, bool playliststhumbs, bool toplistthumbs, bool currentplayingthumbs)
+void SpotifyInterface::clean(bool search, bool artistbrowse, bool albumbrowse, bool playlists, bool toplists, bool currentplayingthumbs)
 {
   CLog::Log(LOGNOTICE, "Spotifylog: clean");
   if (search)
@@ -801,53 +1275,25 @@ void SpotifyInterface::clean(bool search, bool artistbrowse, bool albumbrowse, b
     //stop the thumb downloading and release the images
     while (!m_searchWaitingThumbs.empty())
     {
-      imageItemPair pair = m_searchWaitingThumbs.back();
-      CFileItemPtr pItem = pair.second;
-      sp_image_remove_load_callback(pair.first,&cb_imageLoaded, pItem.get());
-      if (pair.first)
-        sp_image_release(pair.first);
+      cancelThumb(m_searchWaitingThumbs.back());
       m_searchWaitingThumbs.pop_back();
     }
 
-    if (m_search)
-      sp_search_release(m_search);
-    m_search = 0;
-
-    //clear the result vectors
-    m_searchArtistVector.Clear();
-    m_searchAlbumVector.Clear();
-    m_searchTrackVector.Clear();
+    //the entries release their search objects and thumbnail requests
+    m_currentSearch.reset();
+    m_searchCache.Clear();
   }
 
   if (artistbrowse)
   {
-    //stop the thumb downloading and release the images
-    while (!m_artistWaitingThumbs.empty())
-    {
-      imageItemPair pair = m_artistWaitingThumbs.back();
-      CFileItemPtr pItem = pair.second;
-      sp_image_remove_load_callback(pair.first,&cb_imageLoaded, pItem.get());
-      sp_image_release(pair.first);
-      m_artistWaitingThumbs.pop_back();
-    }
-
-    if (m_artistBrowse)
-      sp_artistbrowse_release(m_artistBrowse);
-    m_artistBrowse = 0;
-    m_artistBrowseStr = "";
-    m_browseArtistMenuVector.Clear();
-    m_browseArtistAlbumVector.Clear();
-    m_browseArtistSimilarArtistsVector.Clear();
+    //the entries release their browse objects and thumbnail requests
+    m_artistBrowseCache.Clear();
   }
 
   if (albumbrowse)
   {
-    if (m_albumBrowse)
-      sp_albumbrowse_release(m_albumBrowse);
-    m_albumBrowse = 0;
-
-    m_albumBrowseStr = "";
-    m_browseAlbumVector.Clear();
+    m_currentAlbumBrowse.reset();
+    m_albumBrowseCache.Clear();
   }
 
   if (playlists)
@@ -855,14 +1301,14 @@ void SpotifyInterface::clean(bool search, bool artistbrowse, bool albumbrowse, b
     //stop the thumb downloading and release the images
     while (!m_playlistWaitingThumbs.empty())
     {
-      imageItemPair pair = m_playlistWaitingThumbs.back();
-      CFileItemPtr pItem = pair.second;
-      sp_image_remove_load_callback(pair.first,&cb_imageLoaded, pItem.get());
-      sp_image_release(pair.first);
+      cancelThumb(m_playlistWaitingThumbs.back());
       m_playlistWaitingThumbs.pop_back();
     }
 
+    unwatchPlaylists();
     m_playlistItems.Clear();
+    m_playlistOrder.clear();
+    m_playlistTracks.clear();
   }
 
   if (toplists)
@@ -870,10 +1316,7 @@ void SpotifyInterface::clean(bool search, bool artistbrowse, bool albumbrowse, b
     //stop the thumb downloading and release the images
     while (!m_toplistWaitingThumbs.empty())
     {
-      imageItemPair pair = m_toplistWaitingThumbs.back();
-      CFileItemPtr pItem = pair.second;
-      sp_image_remove_load_callback(pair.first,&cb_imageLoaded, pItem.get());
-      sp_image_release(pair.first);
+      cancelThumb(m_toplistWaitingThumbs.back());
       m_toplistWaitingThumbs.pop_back();
     }
 
@@ -893,24 +1336,6 @@ void SpotifyInterface::clean(bool search, bool artistbrowse, bool albumbrowse, b
     m_browseToplistTracksVector.Clear();
   }
 
-  if (searchthumbs)
-  {
-    CUtil::WipeDir(m_thumbDir);
-    CDirectory::Create(m_thumbDir);
-  }
-
-  if (playliststhumbs)
-  {
-    CUtil::WipeDir(m_playlistsThumbDir);
-    CDirectory::Create(m_playlistsThumbDir);
-  }
-
-  if (toplistthumbs)
-  {
-    CUtil::WipeDir(m_toplistsThumbDir);
-    CDirectory::Create(m_toplistsThumbDir);
-  }
-
   if (currentplayingthumbs)
   {
     CUtil::WipeDir(m_currentPlayingDir);
@@ -923,6 +1348,19 @@ void SpotifyInterface::clean(bool search, bool artistbrowse, bool albumbrowse, b
 bool SpotifyInterface::getDirectory(const CStdString &strPath, CFileItemList &items)
 {
   CLog::Log(LOGNOTICE, "Spotifylog: getDirectory: %s", strPath.c_str());
+  //xbmc calls this from its directory thread with the busy dialog up, not from the gui thread
+  if (strPath.Left(35) == "musicdb://spotify/command/addalbum/")
+  {
+    //it writes to the database, it only takes the session lock for the spotify part
+    addAlbumToLibrary();
+    return false;
+  }
+
+  //the dialogs below let go of the session lock while they wait for the user
+  CSingleLock lock(getSessionLock());
+  //the thumbs asked for from now on go before the ones of the lists we leave
+  m_thumbGeneration++;
+  m_thumbCache.NewListing();
   if (strPath.Left(28) == "musicdb://spotify/menu/main/")
   {
     getMainMenuItems(items);
@@ -935,9 +1373,36 @@ bool SpotifyInterface::getDirectory(const CStdString &strPath, CFileItemList &it
     return true;
   }
 
+  if (strPath.Left(37) == "musicdb://spotify/menu/search/recent/")
+  {
+    if (!reconnect() || isSearching())
+    {
+      return true;
+    }
+    CStdString id = strPath.Mid(37);
+    CUtil::RemoveSlashAtEnd(id);
+    if (id.IsEmpty())
+    {
+      getRecentSearchItems(items);
+      return true;
+    }
+    //show the results of an old search again
+    for (SearchCache::iterator it = m_searchCache.Begin(); it != m_searchCache.End(); ++it)
+    {
+      if (it->second->m_id == atoi(id.c_str()) && it->second->m_isLoaded && !isSearchExpired(it->second.get()))
+      {
+        m_currentSearch = m_searchCache.Get(it->first);
+        getSearchMenuItems(items);
+        return true;
+      }
+    }
+    getRecentSearchItems(items);
+    return true;
+  }
+
   if (strPath.Left(30) == "musicdb://spotify/menu/search/")
   {
-    if (!reconnect() || m_isSearching)
+    if (!reconnect() || isSearching())
     {
       return true;
     }
@@ -960,9 +1425,12 @@ bool SpotifyInterface::getDirectory(const CStdString &strPath, CFileItemList &it
 
   if (strPath.Left(33) == "musicdb://spotify/menu/playlists/")
   {
-    if (!reconnect())
+    //until the playlists have synced we show the ones from the last time
+    bool isLoggedIn = reconnect();
+    if (!isLoggedIn || m_snapshotPending)
     {
-      return true;
+      if (getSnapshot("playlists", items) || !isLoggedIn)
+        return true;
     }
     getPlaylistItems(items);
     return true;
@@ -1005,23 +1473,66 @@ bool SpotifyInterface::getDirectory(const CStdString &strPath, CFileItemList &it
     return false;
   }
 
-  if (strPath.Left(33) == "musicdb://spotify/artists/search/")
+  if (strPath.Left(36) == "musicdb://spotify/command/dumpstats/")
   {
-    if (!reconnect())
+    //dumpstats/reset/ starts counting again after the dump
+    SpotifyStats::Dump(strPath.Mid(36).Left(6) == "reset/");
+    //the conversion has no other test, its result goes in the log next to the stats
+    SpotifyResampler::SelfTest();
+    return false;
+  }
+
+  if (strPath.Left(39) == "musicdb://spotify/command/importartist/")
+  {
+    if (reconnect())
+      importArtist(strPath);
+    return false;
+  }
+
+  if (strPath.Left(41) == "musicdb://spotify/command/importplaylist/")
+  {
+    if (reconnect())
     {
-      return true;
+      CStdString playListNr = strPath.Mid(41);
+      CUtil::RemoveSlashAtEnd(playListNr);
+      importPlaylist(atoi(playListNr.c_str()));
     }
-    items.Append(m_searchArtistVector);
-    return true;
+    return false;
   }
 
-  if (strPath.Left(35) == "musicdb://spotify/command/addalbum/")
+  if (strPath.Left(37) == "musicdb://spotify/command/moresearch/")
   {
-    addAlbumToLibrary();
-    clean(false,false,true,false,false,false,false,false,false);
+    if (!reconnect())
+    {
+      return false;
+    }
+    CStdString kind = strPath.Mid(37);
+    CUtil::RemoveSlashAtEnd(kind);
+    searchMore(kind);
     return false;
   }
 
+  if (strPath.Left(33) == "musicdb://spotify/artists/search/")
+  {
+    if (!reconnect())
+    {
+      return true;
+    }
+    if (m_currentSearch)
+    {
+      items.Append(m_currentSearch->m_artists);
+      //the next page is loaded when the user gets to the end and asks for it
+      if (m_currentSearch->m_moreArtists)
+      {
+        CFileItemPtr pItem(new CFileItem("More artists"));
+        pItem->m_strPath = "musicdb://spotify/command/moresearch/artists/";
+        pItem->m_bIsFolder = true;
+        items.Add(pItem);
+      }
+    }
+    return true;
+  }
+
   if (strPath.Left(39) == "musicdb://spotify/artists/artistbrowse/")
   {
     if (!reconnect())
@@ -1042,7 +1553,18 @@ bool SpotifyInterface::getDirectory(const CStdString &strPath, CFileItemList &it
     {
       return true;
     }
-    items.Append(m_searchAlbumVector);
+    if (m_currentSearch)
+    {
+      items.Append(m_currentSearch->m_albums);
+      //the next page is loaded when the user gets to the end and asks for it
+      if (m_currentSearch->m_moreAlbums)
+      {
+        CFileItemPtr pItem(new CFileItem("More albums"));
+        pItem->m_strPath = "musicdb://spotify/command/moresearch/albums/";
+        pItem->m_bIsFolder = true;
+        items.Add(pItem);
+      }
+    }
     return true;
   }
 
@@ -1070,7 +1592,18 @@ bool SpotifyInterface::getDirectory(const CStdString &strPath, CFileItemList &it
     {
       return true;
     }
-    items.Append(m_searchTrackVector);
+    if (m_currentSearch)
+    {
+      items.Append(m_currentSearch->m_tracks);
+      //the next page is loaded when the user gets to the end and asks for it
+      if (m_currentSearch->m_moreTracks)
+      {
+        CFileItemPtr pItem(new CFileItem("More tracks"));
+        pItem->m_strPath = "musicdb://spotify/command/moresearch/tracks/";
+        pItem->m_bIsFolder = true;
+        items.Add(pItem);
+      }
+    }
     return true;
   }
 
@@ -1085,14 +1618,24 @@ bool SpotifyInterface::getDirectory(const CStdString &strPath, CFileItemList &it
 
   if (strPath.Left(34) == "musicdb://spotify/tracks/playlist/")
   {
-    if (!reconnect())
-    {
-      return true;
-    }
+    //musicdb://spotify/tracks/playlist/<playlist>/<page>/
     CStdString playListNr = strPath;
     playListNr.Delete(0, 34);
     CUtil::RemoveSlashAtEnd(playListNr);
-    getPlaylistTracks(items,atoi(playListNr.c_str()));
+    int page = 0;
+    int slash = playListNr.Find('/');
+    if (slash >= 0)
+    {
+      page = atoi(playListNr.Mid(slash + 1).c_str());
+      playListNr = playListNr.Left(slash);
+    }
+    bool isLoggedIn = reconnect();
+    if (!isLoggedIn || m_snapshotPending)
+    {
+      if ((page == 0 && getSnapshot("playlist/" + playListNr, items)) || !isLoggedIn)
+        return true;
+    }
+    getPlaylistTracks(items,atoi(playListNr.c_str()),page);
     if (items.IsEmpty())
       return false;
     return true;
@@ -1217,24 +1760,104 @@ void SpotifyInterface::getSettingsMenuItems(CFileItemList &items)
   //pItem5->SetThumbnailImage(CUtil::GetDefaultFolderThumb("special://xbmc/media/spotify_core_logo.png"));
   items.Add(pItem5);
 
+  //playback stats
+  share.strPath.Format("musicdb://spotify/command/dumpstats/");
+  share.strName.Format("Write playback statistics to the log");
+  CFileItemPtr pItem6(new CFileItem(share));
+  items.Add(pItem6);
+  share.strPath.Format("musicdb://spotify/command/dumpstats/reset/");
+  share.strName.Format("Write playback statistics to the log and reset them");
+  CFileItemPtr pItem6b(new CFileItem(share));
+  items.Add(pItem6b);
+
   //disclaimer
   //share.strPath.Format("spotify://disclaimer");
   //share.strName.Format("Show Disclaimer");
-  //CFileItemPtr pItem6(new CFileItem(share));
-  //pItem6->SetThumbnailImage(CUtil::GetDefaultFolderThumb("special://xbmc/media/spotify_core_logo.png"));
-  //items.Add(pItem6);
+  //CFileItemPtr pItem7(new CFileItem(share));
+  //pItem7->SetThumbnailImage(CUtil::GetDefaultFolderThumb("special://xbmc/media/spotify_core_logo.png"));
+  //items.Add(pItem7);
+}
+
+void SpotifyInterface::addSearchResults(SpotifySearch *entry, sp_search *search, bool artists, bool albums, bool tracks)
+{
+  //get the artists
+  for (int index=0; index < sp_search_num_artists(search); index++)
+  {
+    CFileItemPtr pItem;
+    pItem = spArtistToItem(sp_search_artist(search, index));
+//      pItem->SetContentType("spotify search artist");
+    entry->m_artists.Add(pItem);
+  }
+
+  //albums
+  for (int index=0; index < sp_search_num_albums(search); index++)
+  {
+    sp_album *spAlbum = sp_search_album(search,index);
+    if ( sp_album_is_available(spAlbum))
+    {
+      sp_artist *spArtist = sp_album_artist(spAlbum);
+      //is the album in our library?
+      CFileItemPtr pItem = m_albumIndex.Find(sp_album_name(spAlbum), sp_artist_name(spArtist));
+      if (!pItem)
+        pItem = spAlbumToItem(spAlbum, SEARCH_ALBUM);
+      entry->m_albums.Add(pItem);
+    }
+  }
+
+  //tracks
+  for (int index=0; index < sp_search_num_tracks(search); index++)
+  {
+    sp_track *spTrack = sp_search_track(search,index);
+    if ( sp_track_is_available(spTrack))
+    {
+      CFileItemPtr pItem;
+      pItem = spTrackToItem(spTrack,SEARCH_TRACK,true);
+//        pItem->SetContentType("audio/spotify");
+      entry->m_tracks.Add(pItem);
+    }
+  }
+
+  //a full page means there can be more where it came from
+  if (artists)
+  {
+    int requested = getSearchPageSize(entry->m_artistOffset, g_advancedSettings.m_spotifyMaxSearchArtists);
+    entry->m_artistOffset += sp_search_num_artists(search);
+    entry->m_moreArtists = sp_search_num_artists(search) >= requested && entry->m_artistOffset < g_advancedSettings.m_spotifyMaxSearchArtists;
+  }
+  if (albums)
+  {
+    int requested = getSearchPageSize(entry->m_albumOffset, g_advancedSettings.m_spotifyMaxSearchAlbums);
+    entry->m_albumOffset += sp_search_num_albums(search);
+    entry->m_moreAlbums = sp_search_num_albums(search) >= requested && entry->m_albumOffset < g_advancedSettings.m_spotifyMaxSearchAlbums;
+  }
+  if (tracks)
+  {
+    int requested = getSearchPageSize(entry->m_trackOffset, g_advancedSettings.m_spotifyMaxSearchTracks);
+    entry->m_trackOffset += sp_search_num_tracks(search);
+    entry->m_moreTracks = sp_search_num_tracks(search) >= requested && entry->m_trackOffset < g_advancedSettings.m_spotifyMaxSearchTracks;
+  }
+}
+
+int SpotifyInterface::getSearchPageSize(int offset, int max)
+{
+  int size = max - offset;
+  if (size > g_advancedSettings.m_spotifySearchPageSize)
+    size = g_advancedSettings.m_spotifySearchPageSize;
+  return size > 0 ? size : 0;
 }
 
 void SpotifyInterface::getSearchMenuItems(CFileItemList &items)
 {
   CMediaSource share;
   CStdString thumb;
-  CStdString query = sp_search_query(m_search);
+  if (!m_currentSearch)
+    return;
+  CStdString query = m_currentSearch->m_query;
   //artists
-  if (!m_searchArtistVector.IsEmpty())
+  if (!m_currentSearch->m_artists.IsEmpty())
   {
     share.strPath.Format("musicdb://spotify/artists/search/");
-    share.strName.Format("%s, %i artists",query.c_str(), m_searchArtistVector.Size());
+    share.strName.Format("%s, %i artists",query.c_str(), m_currentSearch->m_artists.Size());
   }else
   {
     share.strPath.Format("musicdb://spotify/menu/search/");
@@ -1245,10 +1868,10 @@ void SpotifyInterface::getSearchMenuItems(CFileItemList &items)
   items.Add(pItem3);
 
   //albums
-  if (!m_searchAlbumVector.IsEmpty())
+  if (!m_currentSearch->m_albums.IsEmpty())
   {
     share.strPath.Format("musicdb://spotify/albums/search/");
-    share.strName.Format("%s, %i albums",query.c_str(), m_searchAlbumVector.Size());
+    share.strName.Format("%s, %i albums",query.c_str(), m_currentSearch->m_albums.Size());
   }else
   {
     share.strPath.Format("musicdb://spotify/menu/search/");
@@ -1258,23 +1881,23 @@ void SpotifyInterface::getSearchMenuItems(CFileItemList &items)
 
   //what thumb should we have?
   pItem4->SetThumbnailImage("DefaultMusicAlbums.png");
-  /*if (!m_searchAlbumVector.IsEmpty())
+  /*if (!m_currentSearch->m_albums.IsEmpty())
   {
     //request a thumbnail image
-    CURL url = m_searchAlbumVector[0]->GetAsUrl();
+    CURL url = m_currentSearch->m_albums[0]->GetAsUrl();
     CStdString Uri = url.GetFileNameWithoutPath();
     CUtil::RemoveExtension(Uri);
     sp_album *spAlbum = sp_link_as_album(sp_link_create_from_string(Uri));
-    url = m_searchAlbumVector[0]->GetAsUrl();
+    url = m_currentSearch->m_albums[0]->GetAsUrl();
     CLog::Log( LOGDEBUG, "Spotifylog: searchmenu thumb:%s", Uri.c_str());
     requestThumb((unsigned char*)sp_album_cover(spAlbum),Uri, pItem4, SEARCH_ALBUM);
   }*/
   items.Add(pItem4);
   //tracks
-  if (!m_searchTrackVector.IsEmpty())
+  if (!m_currentSearch->m_tracks.IsEmpty())
   {
     share.strPath.Format("musicdb://spotify/tracks/search/");
-    share.strName.Format("%s, %i tracks",query.c_str(), m_searchTrackVector.Size());
+    share.strName.Format("%s, %i tracks",query.c_str(), m_currentSearch->m_tracks.Size());
   }else
   {
     share.strPath.Format("musicdb://spotify/menu/search/");
@@ -1284,10 +1907,10 @@ void SpotifyInterface::getSearchMenuItems(CFileItemList &items)
 
   //what thumb should we have?
   pItem5->SetThumbnailImage("DefaultMusicSongs.png");
-  /*if (!m_searchTrackVector.IsEmpty())
+  /*if (!m_currentSearch->m_tracks.IsEmpty())
   {
     //request a thumbnail image
-    CURL url = m_searchTrackVector[0]->GetAsUrl();
+    CURL url = m_currentSearch->m_tracks[0]->GetAsUrl();
     CStdString Uri = url.GetFileNameWithoutPath();
     CUtil::RemoveExtension(Uri);
 
@@ -1306,91 +1929,368 @@ void SpotifyInterface::getSearchMenuItems(CFileItemList &items)
   CFileItemPtr pItem6(new CFileItem(share));
   //pItem6->SetThumbnailImage(CUtil::GetDefaultFolderThumb("special://xbmc/media/spotify_core_logo.png"));
   items.Add(pItem6);
+  //the searches before this one
+  if (m_searchCache.Size() > 1)
+  {
+    share.strPath.Format("musicdb://spotify/menu/search/recent/");
+    share.strName.Format("Recent searches");
+    CFileItemPtr pItem7(new CFileItem(share));
+    items.Add(pItem7);
+  }
+}
+
+void SpotifyInterface::getRecentSearchItems(CFileItemList &items)
+{
+  //newest first, the way the cache keeps them
+  CMediaSource share;
+  for (SearchCache::iterator it = m_searchCache.Begin(); it != m_searchCache.End(); ++it)
+  {
+    SpotifySearch *entry = it->second.get();
+    if (!entry->m_isLoaded || isSearchExpired(entry))
+      continue;
+    share.strPath.Format("musicdb://spotify/menu/search/recent/%i/", entry->m_id);
+    share.strName.Format("%s, %i artists, %i albums, %i tracks", entry->m_query.c_str(), entry->m_artists.Size(), entry->m_albums.Size(), entry->m_tracks.Size());
+    CFileItemPtr pItem(new CFileItem(share));
+    items.Add(pItem);
+  }
 }
 
+CStdString SpotifyInterface::getSearchKey(CStdString query)
+{
+  //"Daft  Punk " and "daft punk" are the same search
+  query.Trim();
+  query.ToLower();
+  CStdString key;
+  bool space = false;
+  for (unsigned int i = 0; i < query.size(); i++)
+  {
+    if (isspace((unsigned char)query[i]))
+    {
+      space = true;
+      continue;
+    }
+    if (space)
+      key += ' ';
+    space = false;
+    key += query[i];
+  }
+
+  //the same query with other limits gives other results
+  CStdString limits;
+  limits.Format("|%i|%i|%i", g_advancedSettings.m_spotifyMaxSearchTracks, g_advancedSettings.m_spotifyMaxSearchAlbums, g_advancedSettings.m_spotifyMaxSearchArtists);
+  return key + limits;
+}
+
+bool SpotifyInterface::isSearchExpired(SpotifySearch *entry)
+{
+  return difftime(time(NULL), entry->m_time) > g_advancedSettings.m_spotifySearchCacheTtl * 60;
+}
+
+
 bool SpotifyInterface::getBrowseArtistMenu(CStdString strPath, CFileItemList &items)
 {
   if (reconnect())
   {
-    //do we have this artist loaded allready?
-    CURL url(strPath);
-    CStdString newUri = url.GetFileNameWithoutPath();
+    ArtistBrowsePtr entry = getArtistBrowse(strPath);
+    if (entry && entry->m_isLoaded)
+      items.Append(entry->m_menu);
+    return true;
+  }
+  return false;
+}
 
-    
-    CURL oldUrl(m_artistBrowseStr);
-    CStdString uri = oldUrl.GetFileNameWithoutPath();
-    
-    CLog::Log(LOGNOTICE, "Spotifylog: get artist menu new: %s old: %s", newUri.c_str(), uri.c_str());
+void SpotifyInterface::getPlaylistItems(CFileItemList &items)
+{
+  //while we are watching the container the callbacks keep the items up to date
+  if (!m_watchedContainer)
+    syncPlaylistItems();
+  items.Append(m_playlistItems);
+}
 
-    if (newUri == uri)
+CFileItemPtr SpotifyInterface::spPlaylistToItem(sp_playlist *pl, int index, bool withThumbRequest, CFileItemPtr previous)
+{
+  CMediaSource share;
+  if (sp_playlist_is_loaded(pl))
+  {
+    share.strPath.Format("musicdb://spotify/tracks/playlist/%ld/", index);
+    share.strName.Format("%s",sp_playlist_name(pl));
+  }else
+  {
+    share.strPath.Format("musicdb://spotify/menu/playlists/");
+    share.strName.Format("Loading playlist...");
+  }
+  CFileItemPtr pItem(new CFileItem(share));
+  //ask for a thumbnail
+  pItem->SetThumbnailImage("DefaultMusicPlaylists.png");
+  if (sp_playlist_is_loaded(pl) && sp_playlist_num_tracks(pl) > 0)
+  {
+    sp_track *spTrack = sp_playlist_track(pl,0);
+    sp_album *spAlbum = sp_track_album(spTrack);
+    unsigned char *imageId = (unsigned char*)sp_album_cover(spAlbum);
+    if (withThumbRequest && imageId && previous && previous->GetThumbnailImage() == m_thumbCache.GetPath(imageId))
     {
-      items.Append(m_browseArtistMenuVector);
-      return true;
+      //the state changes a lot while loading, the cover we already have is still good
+      pItem->SetExtraInfo(previous->GetExtraInfo());
+      pItem->SetThumbnailImage(previous->GetThumbnailImage());
     }
-    else
+    else if (withThumbRequest)
+      requestThumb(imageId, pItem, PLAYLIST_TRACK);
+    else if (spAlbum && !getAlbumThumb(spAlbum).IsEmpty())
+      pItem->SetThumbnailImage(getAlbumThumb(spAlbum));
+  }
+  return pItem;
+}
+
+void SpotifyInterface::syncPlaylistItems()
+{
+  //the items we already have are kept, only the new playlists get new items and thumbnails
+  sp_playlistcontainer *pc = sp_session_playlistcontainer(m_session);
+  CFileItemList items;
+  std::vector<sp_playlist*> order;
+  for (int i=0; pc && i < sp_playlistcontainer_num_playlists(pc); i++)
+  {
+    sp_playlist *pl = sp_playlistcontainer_playlist(pc, i);
+    CFileItemPtr pItem;
+    for (unsigned int j = 0; j < m_playlistOrder.size(); j++)
     {
-      return browseArtist(strPath);
+      if (m_playlistOrder[j] == pl)
+      {
+        pItem = m_playlistItems[j];
+        break;
+      }
     }
+    //a playlist that has moved gets a new item, the old one may be on screen
+    CStdString path;
+    path.Format("musicdb://spotify/tracks/playlist/%ld/", i);
+    if (!pItem || (sp_playlist_is_loaded(pl) && pItem->m_strPath != path))
+      pItem = spPlaylistToItem(pl, i, true, pItem);
+    items.Add(pItem);
+    order.push_back(pl);
   }
-  return false;
+
+  //the pages are kept by position, they are read again when they are opened
+  if (order != m_playlistOrder)
+    m_playlistTracks.clear();
+
+  m_playlistItems.Clear();
+  m_playlistItems.Append(items);
+  m_playlistOrder = order;
 }
 
-void SpotifyInterface::getPlaylistItems(CFileItemList &items)
+void SpotifyInterface::updatePlaylistItem(sp_playlist *pl)
 {
-  //get the playlists
-  CMediaSource share;
-  sp_playlistcontainer *pc = sp_session_playlistcontainer(m_session);
-  for (int i=0; i < sp_playlistcontainer_num_playlists(pc); i++)
+  for (unsigned int i = 0; i < m_playlistOrder.size(); i++)
   {
-    sp_playlist* pl = sp_playlistcontainer_playlist(pc, i);
-    if (sp_playlist_is_loaded(pl))
+    if (m_playlistOrder[i] == pl)
     {
-      share.strPath.Format("musicdb://spotify/tracks/playlist/%ld/", i);
-      share.strName.Format("%s",sp_playlist_name(pl));
-    }else
+      //the list has to be built again, the items are shared with the ones on screen
+      CFileItemList items;
+      for (int j = 0; j < m_playlistItems.Size(); j++)
+        items.Add((unsigned int)j == i ? spPlaylistToItem(pl, i, true, m_playlistItems[j]) : m_playlistItems[j]);
+      m_playlistItems.Clear();
+      m_playlistItems.Append(items);
+      break;
+    }
+  }
+}
+
+void SpotifyInterface::playlistTracksChanged(sp_playlist *pl)
+{
+  for (unsigned int i = 0; i < m_playlistOrder.size(); i++)
+  {
+    if (m_playlistOrder[i] != pl)
+      continue;
+    //read the handles again if the playlist has been opened
+    std::map<int, PlaylistTracksPtr>::iterator it = m_playlistTracks.find(i);
+    int lastPage = 0;
+    if (it != m_playlistTracks.end() && it->second)
     {
-      share.strPath.Format("musicdb://spotify/menu/playlists/");
-      share.strName.Format("Loading playlist...");
+      it->second->Update();
+      lastPage = it->second->m_lastPage;
     }
-    CFileItemPtr pItem(new CFileItem(share));
-    CStdString thumb = "DefaultPlaylist.png";
-    //ask for a thumbnail
-    pItem->SetThumbnailImage("DefaultMusicPlaylists.png");
-    if (sp_playlist_is_loaded(pl) && sp_playlist_num_tracks(pl) > 0)
-    {
-      sp_track *spTrack = sp_playlist_track(pl,0);
-      sp_album *spAlbum = sp_track_album(spTrack);
-      sp_link *spLink  = sp_link_create_from_album(spAlbum);
-      CStdString Uri = "";
-      char spotify_uri[256];
-      sp_link_as_string (spLink,spotify_uri,256);
-      sp_link_release(spLink);
-      Uri.Format("%s", spotify_uri);
-      CLog::Log( LOGDEBUG, "Spotifylog: searchmenu thumb:%s", Uri.c_str());
-      requestThumb((unsigned char*)sp_album_cover(spAlbum),Uri, pItem, PLAYLIST_TRACK);
+
+    //any of the opened pages can be the one on screen, the window only refreshes the one it shows
+    for (int page = 0; page <= lastPage; page++)
+    {
+      CStdString path;
+      if (page == 0)
+        path.Format("musicdb://spotify/tracks/playlist/%i/", i);
+      else
+        path.Format("musicdb://spotify/tracks/playlist/%i/%i/", i, page);
+      CGUIMessage message(GUI_MSG_NOTIFY_ALL, 0, 0, GUI_MSG_UPDATE_PATH);
+      message.SetStringParam(path);
+      g_windowManager.SendThreadMessage(message);
     }
-    items.Add(pItem);
+    break;
   }
 }
 
+void SpotifyInterface::watchPlaylists()
+{
+  unwatchPlaylists();
+  sp_playlistcontainer *pc = sp_session_playlistcontainer(m_session);
+  if (!pc)
+    return;
+
+  memset(&m_containerCallbacks, 0, sizeof(m_containerCallbacks));
+  m_containerCallbacks.playlist_added = &cb_playlistAdded;
+  m_containerCallbacks.playlist_removed = &cb_playlistRemoved;
+  m_containerCallbacks.playlist_moved = &cb_playlistMoved;
+  memset(&m_playlistCallbacks, 0, sizeof(m_playlistCallbacks));
+  m_playlistCallbacks.tracks_added = &cb_playlistTracksAdded;
+  m_playlistCallbacks.tracks_removed = &cb_playlistTracksRemoved;
+  m_playlistCallbacks.tracks_moved = &cb_playlistTracksMoved;
+  m_playlistCallbacks.playlist_renamed = &cb_playlistChanged;
+  m_playlistCallbacks.playlist_state_changed = &cb_playlistChanged;
+
+  sp_playlistcontainer_add_callbacks(pc, &m_containerCallbacks, this);
+  m_watchedContainer = pc;
+  syncPlaylistItems();
+  //the ones that are added later get theirs in cb_playlistAdded
+  for (unsigned int i = 0; i < m_playlistOrder.size(); i++)
+    sp_playlist_add_callbacks(m_playlistOrder[i], &m_playlistCallbacks, this);
+}
+
+void SpotifyInterface::unwatchPlaylists()
+{
+  if (!m_watchedContainer)
+    return;
+  for (unsigned int i = 0; i < m_playlistOrder.size(); i++)
+    sp_playlist_remove_callbacks(m_playlistOrder[i], &m_playlistCallbacks, this);
+  sp_playlistcontainer_remove_callbacks(m_watchedContainer, &m_containerCallbacks, this);
+  m_watchedContainer = 0;
+}
+
+void SpotifyInterface::cb_playlistAdded(sp_playlistcontainer *pc, sp_playlist *playlist, int position, void *userdata)
+{
+  SpotifyInterface *spInt = (SpotifyInterface*)userdata;
+  CLog::Log( LOGDEBUG, "Spotifylog: playlist added at %i", position);
+  sp_playlist_add_callbacks(playlist, &spInt->m_playlistCallbacks, spInt);
+  spInt->syncPlaylistItems();
+  CGUIMessage message(GUI_MSG_NOTIFY_ALL, 0, 0, GUI_MSG_UPDATE_PATH);
+  message.SetStringParam("musicdb://spotify/menu/playlists/");
+  g_windowManager.SendThreadMessage(message);
+}
+
+void SpotifyInterface::cb_playlistRemoved(sp_playlistcontainer *pc, sp_playlist *playlist, int position, void *userdata)
+{
+  SpotifyInterface *spInt = (SpotifyInterface*)userdata;
+  CLog::Log( LOGDEBUG, "Spotifylog: playlist removed at %i", position);
+  sp_playlist_remove_callbacks(playlist, &spInt->m_playlistCallbacks, spInt);
+  spInt->syncPlaylistItems();
+  CGUIMessage message(GUI_MSG_NOTIFY_ALL, 0, 0, GUI_MSG_UPDATE_PATH);
+  message.SetStringParam("musicdb://spotify/menu/playlists/");
+  g_windowManager.SendThreadMessage(message);
+}
+
+void SpotifyInterface::cb_playlistMoved(sp_playlistcontainer *pc, sp_playlist *playlist, int position, int new_position, void *userdata)
+{
+  SpotifyInterface *spInt = (SpotifyInterface*)userdata;
+  CLog::Log( LOGDEBUG, "Spotifylog: playlist moved from %i to %i", position, new_position);
+  spInt->syncPlaylistItems();
+  CGUIMessage message(GUI_MSG_NOTIFY_ALL, 0, 0, GUI_MSG_UPDATE_PATH);
+  message.SetStringParam("musicdb://spotify/menu/playlists/");
+  g_windowManager.SendThreadMessage(message);
+}
+
+void SpotifyInterface::cb_playlistTracksAdded(sp_playlist *pl, sp_track * const *tracks, int num_tracks, int position, void *userdata)
+{
+  SpotifyInterface *spInt = (SpotifyInterface*)userdata;
+  spInt->playlistTracksChanged(pl);
+  //the first track gives the thumbnail
+  if (position == 0)
+    cb_playlistChanged(pl, userdata);
+}
+
+void SpotifyInterface::cb_playlistTracksRemoved(sp_playlist *pl, const int *tracks, int num_tracks, void *userdata)
+{
+  SpotifyInterface *spInt = (SpotifyInterface*)userdata;
+  spInt->playlistTracksChanged(pl);
+}
+
+void SpotifyInterface::cb_playlistTracksMoved(sp_playlist *pl, const int *tracks, int num_tracks, int new_position, void *userdata)
+{
+  SpotifyInterface *spInt = (SpotifyInterface*)userdata;
+  spInt->playlistTracksChanged(pl);
+}
+
+void SpotifyInterface::cb_playlistChanged(sp_playlist *pl, void *userdata)
+{
+  //renamed or loaded, only its own item changes
+  SpotifyInterface *spInt = (SpotifyInterface*)userdata;
+  spInt->updatePlaylistItem(pl);
+  CGUIMessage message(GUI_MSG_NOTIFY_ALL, 0, 0, GUI_MSG_UPDATE_PATH);
+  message.SetStringParam("musicdb://spotify/menu/playlists/");
+  g_windowManager.SendThreadMessage(message);
+}
+
 bool SpotifyInterface::search()
 {
   CStdString searchString = "";
-  while (searchString.IsEmpty())
-    CGUIDialogKeyboard::ShowAndGetInput(searchString,"Spotify search",false);
+  {
+    //dont keep the session thread waiting while the user is typing
+    CSingleExit ex(getSessionLock());
+    while (searchString.IsEmpty())
+      CGUIDialogKeyboard::ShowAndGetInput(searchString,"Spotify search",false);
+  }
   return search(searchString);
 }
 
 bool SpotifyInterface::search(CStdString searchstring)
 {
-  m_searchStr = searchstring;
   CLog::Log(LOGDEBUG, "Spotifylog: search");
-  clean(true,true,true,false,false,true,false,false,false);
-  m_search = sp_search_create(m_session, searchstring, 0, g_advancedSettings.m_spotifyMaxSearchTracks, 0, g_advancedSettings.m_spotifyMaxSearchAlbums, 0, g_advancedSettings.m_spotifyMaxSearchArtists, &cb_searchComplete, NULL);
+  CStdString key = getSearchKey(searchstring);
+
+  //have we done this search a short while ago?
+  SearchPtr entry = m_searchCache.Get(key);
+  if (entry && entry->m_isLoaded && !isSearchExpired(entry.get()))
+  {
+    CLog::Log(LOGDEBUG, "Spotifylog: search results for %s are cached", searchstring.c_str());
+    m_currentSearch = entry;
+    CGUIMessage message(GUI_MSG_NOTIFY_ALL, 0, 0, GUI_MSG_UPDATE_PATH);
+    message.SetStringParam("musicdb://spotify/menu/search/");
+    g_windowManager.SendThreadMessage(message);
+    return true;
+  }
+  if (entry)
+    m_searchCache.Remove(key);
+
+  entry = SearchPtr(new SpotifySearch(m_nextSearchId++, searchstring));
+  m_searchCache.Put(key, entry);
+  m_currentSearch = entry;
+  //only the first page, so the results show up fast
+  int tracks = getSearchPageSize(0, g_advancedSettings.m_spotifyMaxSearchTracks);
+  int albums = getSearchPageSize(0, g_advancedSettings.m_spotifyMaxSearchAlbums);
+  int artists = getSearchPageSize(0, g_advancedSettings.m_spotifyMaxSearchArtists);
+  entry->m_search = sp_search_create(m_session, searchstring, 0, tracks, 0, albums, 0, artists, &cb_searchComplete, NULL);
   CStdString message;
   message.Format("Searching for %s", searchstring.c_str());
   showProgressDialog(message);
-  m_isSearching = true;
+  return true;
+}
+
+bool SpotifyInterface::searchMore(CStdString kind)
+{
+  if (!m_currentSearch || !m_currentSearch->m_isLoaded || m_currentSearch->m_pageSearch)
+    return false;
+  SpotifySearch *entry = m_currentSearch.get();
+
+  int tracks = 0, albums = 0, artists = 0;
+  if (kind == "artists" && entry->m_moreArtists)
+    artists = getSearchPageSize(entry->m_artistOffset, g_advancedSettings.m_spotifyMaxSearchArtists);
+  else if (kind == "albums" && entry->m_moreAlbums)
+    albums = getSearchPageSize(entry->m_albumOffset, g_advancedSettings.m_spotifyMaxSearchAlbums);
+  else if (kind == "tracks" && entry->m_moreTracks)
+    tracks = getSearchPageSize(entry->m_trackOffset, g_advancedSettings.m_spotifyMaxSearchTracks);
+  if (tracks + albums + artists == 0)
+    return false;
+
+  CLog::Log(LOGDEBUG, "Spotifylog: search more %s", kind.c_str());
+  entry->m_pageKind = kind;
+  entry->m_pageSearch = sp_search_create(m_session, entry->m_query, entry->m_trackOffset, tracks, entry->m_albumOffset, albums, entry->m_artistOffset, artists, &cb_searchPageComplete, NULL);
+  CStdString message;
+  message.Format("Loading more %s", kind.c_str());
+  showProgressDialog(message);
   return true;
 }
 
@@ -1398,22 +2298,10 @@ bool SpotifyInterface::getBrowseArtistAlbums(CStdString strPath, CFileItemList &
 {
   if (reconnect())
   {
-    //do we have this artist loaded allready?
-    CURL url(strPath);
-    CStdString newUri = url.GetFileNameWithoutPath();
-
-    CURL oldUrl(m_artistBrowseStr);
-    CStdString uri = oldUrl.GetFileNameWithoutPath();
-
-    if (newUri == uri)
-    {
-      items.Append(m_browseArtistAlbumVector);
-      return true;
-    }
-    else
-    {
-      return browseArtist(strPath);
-    }
+    ArtistBrowsePtr entry = getArtistBrowse(strPath);
+    if (entry && entry->m_isLoaded)
+      items.Append(entry->m_albums);
+    return true;
   }
   return false;
 }
@@ -1422,26 +2310,26 @@ bool SpotifyInterface::getBrowseArtistArtists(CStdString strPath, CFileItemList
 {
   if (reconnect())
   {
-    //do we have this artist loaded allready?
-    CURL url(strPath);
-    CStdString newUri = url.GetFileNameWithoutPath();
-
-    CURL oldUrl(m_artistBrowseStr);
-    CStdString uri = oldUrl.GetFileNameWithoutPath();
-
-    if (newUri == uri)
-    {
-      items.Append(m_browseArtistSimilarArtistsVector);
-      return true;
-    }
-    else
-    {
-      return browseArtist(strPath);
-    }
+    ArtistBrowsePtr entry = getArtistBrowse(strPath);
+    if (entry && entry->m_isLoaded)
+      items.Append(entry->m_similarArtists);
+    return true;
   }
   return false;
 }
 
+//returns the artist from the cache, if we dont have it we start browsing it and the window is updated when it is done
+SpotifyInterface::ArtistBrowsePtr SpotifyInterface::getArtistBrowse(CStdString strPath)
+{
+  CURL url(strPath);
+  CStdString uri = url.GetFileNameWithoutPath();
+  ArtistBrowsePtr entry = m_artistBrowseCache.Get(uri);
+  CLog::Log(LOGDEBUG, "Spotifylog: get artist %s, %s", uri.c_str(), entry ? "cached" : "not cached");
+  if (!entry)
+    browseArtist(strPath);
+  return entry;
+}
+
 bool SpotifyInterface::browseArtist(CStdString strPath)
 {
   if (reconnect())
@@ -1453,13 +2341,14 @@ bool SpotifyInterface::browseArtist(CStdString strPath)
     sp_artist * spArtist = sp_link_as_artist(spLink);
     if (spArtist)
     {
-      clean(false,true,false,false,false,false,false,false,false);
       CStdString message;
       message.Format("Browsing albums from %s", sp_artist_name(spArtist));
       showProgressDialog(message);
       CLog::Log( LOGDEBUG, "Spotifylog: browsing artist %s", sp_artist_name(spArtist));
-      m_artistBrowse = sp_artistbrowse_create(m_session, spArtist, &cb_artistBrowseComplete, 0);
-      m_artistBrowseStr = strPath;
+      ArtistBrowsePtr entry(new SpotifyArtistBrowse(strPath));
+      entry->m_browse = sp_artistbrowse_create(m_session, spArtist, &cb_artistBrowseComplete, 0);
+      if (entry->m_browse)
+        m_artistBrowseCache.Put(uri, entry);
       sp_link_release(spLink);
       return true;
     }
@@ -1474,38 +2363,38 @@ bool SpotifyInterface::getBrowseAlbumTracks(CStdString strPath, CFileItemList &i
   {
     //do we have this album loaded allready?
     CURL url(strPath);
-    CStdString newUri = url.GetFileNameWithoutPath();
-
-    CURL oldUrl(m_albumBrowseStr);
-    CStdString uri = oldUrl.GetFileNameWithoutPath();
-
-    if (newUri == uri)
+    CStdString uri = url.GetFileNameWithoutPath();
+    AlbumBrowsePtr entry = m_albumBrowseCache.Get(uri);
+    if (entry)
     {
-      items.Append(m_browseAlbumVector);
+      if (entry->m_isLoaded)
+      {
+        m_currentAlbumBrowse = entry;
+        items.Append(entry->m_tracks);
+      }
       return true;
     }
-    else
+
+    sp_link *spLink = sp_link_create_from_string(uri.c_str());
+    sp_album *spAlbum = sp_link_as_album (spLink);
+    if (spAlbum)
     {
-      sp_link *spLink = sp_link_create_from_string(newUri.c_str());
-      sp_album *spAlbum = sp_link_as_album (spLink);
-      if (spAlbum)
-      {
-        clean(false,false,true,false,false,false,false,false,false);
-        CStdString message;
-        message.Format("Browsing tracks from %s", sp_album_name(spAlbum));
-        showProgressDialog(message);
-        CLog::Log( LOGDEBUG, "Spotifylog: browsing album");
-        m_albumBrowse = sp_albumbrowse_create(m_session, spAlbum, &cb_albumBrowseComplete, spAlbum);
-        m_albumBrowseStr = strPath;
-        sp_link_release(spLink);
-        return true;
-      }
+      CStdString message;
+      message.Format("Browsing tracks from %s", sp_album_name(spAlbum));
+      showProgressDialog(message);
+      CLog::Log( LOGDEBUG, "Spotifylog: browsing album");
+      entry = AlbumBrowsePtr(new SpotifyAlbumBrowse(strPath));
+      entry->m_browse = sp_albumbrowse_create(m_session, spAlbum, &cb_albumBrowseComplete, spAlbum);
+      if (entry->m_browse)
+        m_albumBrowseCache.Put(uri, entry);
+      sp_link_release(spLink);
+      return true;
     }
+    sp_link_release(spLink);
   }
   return false;
 }
 
-//toplists
 bool SpotifyInterface::getBrowseToplistArtists(CFileItemList &items)
 {
   if (reconnect())
@@ -1517,14 +2406,23 @@ bool SpotifyInterface::getBrowseToplistArtists(CFileItemList &items)
     }
     else
     {
-      CStdString message;
-      message.Format("Browsing top artists");
-      showProgressDialog(message);
-      m_toplistArtistsBrowse = sp_toplistbrowse_create(m_session,SP_TOPLIST_TYPE_ARTISTS,SP_TOPLIST_REGION_EVERYWHERE,&cb_topListAritstsComplete,0);
+      //show the last toplist while the new one is on its way
+      bool isShowingSnapshot = getSnapshot("toplist/artists", items);
+      //only one browse at a time, the callback fills the list
+      if (!m_toplistArtistsBrowse)
+      {
+        if (!isShowingSnapshot)
+        {
+          CStdString message;
+          message.Format("Browsing top artists");
+          showProgressDialog(message);
+        }
+        m_toplistArtistsBrowse = sp_toplistbrowse_create(m_session,SP_TOPLIST_TYPE_ARTISTS,SP_TOPLIST_REGION_EVERYWHERE,&cb_topListAritstsComplete,isShowingSnapshot ? 0 : this);
+      }
       return true;
     }
   }
-  return false;
+  return getSnapshot("toplist/artists", items);
 }
 
 bool SpotifyInterface::getBrowseToplistAlbums(CFileItemList &items)
@@ -1538,14 +2436,23 @@ bool SpotifyInterface::getBrowseToplistAlbums(CFileItemList &items)
     }
     else
     {
-      CStdString message;
-      message.Format("Browsing top albums");
-      showProgressDialog(message);
-      m_toplistAlbumsBrowse = sp_toplistbrowse_create(m_session,SP_TOPLIST_TYPE_ALBUMS,SP_TOPLIST_REGION_EVERYWHERE,&cb_topListAlbumsComplete,0);
+      //show the last toplist while the new one is on its way
+      bool isShowingSnapshot = getSnapshot("toplist/albums", items);
+      //only one browse at a time, the callback fills the list
+      if (!m_toplistAlbumsBrowse)
+      {
+        if (!isShowingSnapshot)
+        {
+          CStdString message;
+          message.Format("Browsing top albums");
+          showProgressDialog(message);
+        }
+        m_toplistAlbumsBrowse = sp_toplistbrowse_create(m_session,SP_TOPLIST_TYPE_ALBUMS,SP_TOPLIST_REGION_EVERYWHERE,&cb_topListAlbumsComplete,isShowingSnapshot ? 0 : this);
+      }
       return true;
     }
   }
-  return false;
+  return getSnapshot("toplist/albums", items);
 }
 
 bool SpotifyInterface::getBrowseToplistTracks(CFileItemList &items)
@@ -1559,14 +2466,23 @@ bool SpotifyInterface::getBrowseToplistTracks(CFileItemList &items)
     }
     else
     {
-      CStdString message;
-      message.Format("Browsing top tracks");
-      showProgressDialog(message);
-      m_toplistTracksBrowse = sp_toplistbrowse_create(m_session,SP_TOPLIST_TYPE_TRACKS,SP_TOPLIST_REGION_EVERYWHERE,&cb_topListTracksComplete,0);
+      //show the last toplist while the new one is on its way
+      bool isShowingSnapshot = getSnapshot("toplist/tracks", items);
+      //only one browse at a time, the callback fills the list
+      if (!m_toplistTracksBrowse)
+      {
+        if (!isShowingSnapshot)
+        {
+          CStdString message;
+          message.Format("Browsing top tracks");
+          showProgressDialog(message);
+        }
+        m_toplistTracksBrowse = sp_toplistbrowse_create(m_session,SP_TOPLIST_TYPE_TRACKS,SP_TOPLIST_REGION_EVERYWHERE,&cb_topListTracksComplete,isShowingSnapshot ? 0 : this);
+      }
       return true;
     }
   }
-  return false;
+  return getSnapshot("toplist/tracks", items);
 }
 
 //converting functions
@@ -1574,12 +2490,9 @@ CFileItemPtr SpotifyInterface::spArtistToItem(sp_artist *spArtist)
 {
   //path with artist Uri
   CStdString path;
-  char spotify_uri[256];
-  sp_link_as_string(sp_link_create_from_artist(spArtist),spotify_uri,256);
-  CStdString Uri = "";
-  Uri.Format("%s", spotify_uri);
+  const CStdString &Uri = m_uris.Artist(spArtist);
 
-  path.Format("musicdb://spotify/menu/artistbrowse/%s", Uri);
+  path.Format("musicdb://spotify/menu/artistbrowse/%s", Uri.c_str());
 
   //why the hell is it a CAlbum instead of CArtist?
   //we dont want it to load albums from the database and you cant provide an artist item eith a custom path
@@ -1595,10 +2508,7 @@ CFileItemPtr SpotifyInterface::spAlbumToItem(sp_album *spAlbum, SPOTIFY_TYPE typ
   sp_artist *albumArtist = sp_album_artist(spAlbum);
   //path with album Uri
   CStdString path;
-  CStdString Uri = "";
-  char spotify_uri[256];
-  sp_link_as_string(sp_link_create_from_album(spAlbum),spotify_uri,256);
-  Uri.Format("%s", spotify_uri);
+  const CStdString &Uri = m_uris.Album(spAlbum);
 
   path.Format("musicdb://spotify/tracks/albumbrowse/%s", Uri.c_str());
 
@@ -1609,29 +2519,49 @@ CFileItemPtr SpotifyInterface::spAlbumToItem(sp_album *spAlbum, SPOTIFY_TYPE typ
 
   CFileItemPtr pItem(new CFileItem(path, album));
   pItem->SetThumbnailImage("DefaultMusicAlbums.png");
-  requestThumb((unsigned char*)sp_album_cover(spAlbum),Uri,pItem, type);
+  requestThumb((unsigned char*)sp_album_cover(spAlbum), pItem, type);
   return pItem;
 }
 
 CFileItemPtr SpotifyInterface::spTrackToItem(sp_track *spTrack, SPOTIFY_TYPE type, bool loadthumb)
+{
+  sp_album *spAlbum = sp_track_album(spTrack);
+  CSong song;
+  spTrackToSong(spTrack, song);
+
+  CFileItemPtr pItem(new CFileItem(song));
+  if (loadthumb)
+  {
+    requestThumb((unsigned char*)sp_album_cover(spAlbum), pItem, type);
+  }
+
+  int popularity = sp_track_popularity(spTrack);
+  char rating = '0';
+  if (popularity > 10) rating = '1';
+  if (popularity > 20) rating = '2';
+  if (popularity > 40) rating = '3';
+  if (popularity > 60) rating = '4';
+  if (popularity > 80) rating = '5';
+  pItem->GetMusicInfoTag()->SetRating(rating);
+
+  return pItem;
+}
+
+void SpotifyInterface::spTrackToSong(sp_track *spTrack, CSong &song)
 {
   sp_album *spAlbum = sp_track_album(spTrack);
   sp_artist *spArtist = sp_track_artist(spTrack, 0);
   sp_artist *albumArtist = sp_album_artist(spAlbum);
   CStdString path;
 
-  CStdString Uri;
-  char spotify_uri[256];
-  sp_link_as_string(sp_link_create_from_track(spTrack, 0),spotify_uri,256);
-  Uri.Format("%s", spotify_uri);
-  path.Format("%s.spotify", Uri);
+  const CStdString &Uri = m_uris.Track(spTrack);
+  path.Format("%s.spotify", Uri.c_str());
 
-   CSong song;
    song.strTitle = sp_track_name(spTrack);
   if (!sp_track_is_available(spTrack))
  {
    song.strTitle.Format("NOT PLAYABLE, %s", sp_track_name(spTrack));
-   path.Format("unplayable%s.unplayable", Uri);
+   path.Format("unplayable%s.unplayable", Uri.c_str());
  }
   song.strFileName = path.c_str();
 
@@ -1641,157 +2571,166 @@ CFileItemPtr SpotifyInterface::spTrackToItem(sp_track *spTrack, SPOTIFY_TYPE typ
   song.strAlbum = sp_album_name(spAlbum);
   song.strAlbumArtist = sp_artist_name(albumArtist);
   song.strArtist = sp_artist_name(spArtist);
-
-  CFileItemPtr pItem(new CFileItem(song));
-  if (loadthumb)
-  {
-    CStdString albumUri;
-    char spotify_album_uri[256];
-    sp_link_as_string(sp_link_create_from_album(spAlbum),spotify_album_uri,256);
-    albumUri.Format("%s", spotify_album_uri);
-    requestThumb((unsigned char*)sp_album_cover(spAlbum),albumUri,pItem, type);
-  }
-
-  int popularity = sp_track_popularity(spTrack);
-  char rating = '0';
-  if (popularity > 10) rating = '1';
-  if (popularity > 20) rating = '2';
-  if (popularity > 40) rating = '3';
-  if (popularity > 60) rating = '4';
-  if (popularity > 80) rating = '5';
-  pItem->GetMusicInfoTag()->SetRating(rating);
-
-  return pItem;
 }
 
-bool SpotifyInterface::requestThumb(unsigned char *imageId, CStdString Uri, CFileItemPtr pItem, SPOTIFY_TYPE type)
+CStdString SpotifyInterface::getAlbumThumb(sp_album *spAlbum)
 {
-  //do we have it the cache?
-  CStdString thumb;
-  Uri.Delete(0,14);
+  //requestThumb keeps them by the image id of the cover
+  const unsigned char *imageId = (const unsigned char*)sp_album_cover(spAlbum);
+  if (imageId && m_thumbCache.Has(imageId))
+    return m_thumbCache.GetPath(imageId);
+  return "";
+}
 
-  switch(type){
-  case PLAYLIST_TRACK:
-    thumb.Format("%s%s.tbn", m_playlistsThumbDir, Uri);
-    break;
-  case TOPLIST_ALBUM:
-  case TOPLIST_TRACK:
-    thumb.Format("%s%s.tbn", m_toplistsThumbDir, Uri);
-    break;
-  default:
-    thumb.Format("%s%s.tbn", m_thumbDir, Uri);
-    break;
-  }
+bool SpotifyInterface::requestThumb(unsigned char *imageId, CFileItemPtr pItem, SPOTIFY_TYPE type)
+{
+  //no cover, keep the default thumb
+  if (!imageId)
+    return false;
 
+  //do we have it the cache?
+  CStdString thumb = m_thumbCache.GetPath(imageId);
   pItem->SetExtraInfo(thumb);
-  if (XFILE::CFile::Exists(thumb))
+  if (m_thumbCache.Has(imageId))
   {
     //the file exists, then we dont need to download it again
     pItem->SetThumbnailImage(thumb);
     return true;
-  }else if (imageId)
+  }else
   {
-    //request for it
-    sp_image *spImage = sp_image_create(m_session, (byte*)imageId);
-    if (spImage)
-    {
-      //ok there is one, so download it!
-      sp_image_add_load_callback(spImage, &cb_imageLoaded, pItem.get());
+    //somebody may have asked for it already, then we wait for that one
+    ThumbRequestMap::iterator it = m_thumbRequests.find(thumb);
+    if (it == m_thumbRequests.end())
+    {
+      ThumbRequest &request = m_thumbRequests[thumb];
+      memcpy(request.imageId, imageId, sizeof(request.imageId));
+      request.image = 0;
+      request.isWriting = false;
+      request.generation = m_thumbGeneration;
+      request.sequence = m_thumbSequence++;
+      it = m_thumbRequests.find(thumb);
+    }else if (!it->second.image && !it->second.isWriting && it->second.generation != m_thumbGeneration)
+    {
+      //still waiting and wanted by the list on screen now, move it up
+      it->second.generation = m_thumbGeneration;
+      it->second.sequence = m_thumbSequence++;
+    }
 
-      //we need to remember what we ask for so we can unload their callbacks if we need to
-      imageItemPair pair(spImage, pItem);
-      switch(type){
-      case PLAYLIST_TRACK:
-        m_playlistWaitingThumbs.push_back(pair);
-        break;
-      case TOPLIST_ALBUM:
-      case TOPLIST_TRACK:
-        m_toplistWaitingThumbs.push_back(pair);
-        break;
-      case ARTISTBROWSE_ALBUM:
-        m_artistWaitingThumbs.push_back(pair);
-        break;
-      default:
-        m_searchWaitingThumbs.push_back(pair);
-        break;
-      }
-      return true;
+    //we need to remember what we ask for so we can unload their callbacks if we need to
+    std::vector<imageItemPair> *owner;
+    switch(type){
+    case PLAYLIST_TRACK:
+      owner = &m_playlistWaitingThumbs;
+      break;
+    case TOPLIST_ALBUM:
+    case TOPLIST_TRACK:
+      owner = &m_toplistWaitingThumbs;
+      break;
+    case ARTISTBROWSE_ALBUM:
+      owner = m_thumbArtistBrowse ? &m_thumbArtistBrowse->m_waitingThumbs : &m_searchWaitingThumbs;
+      break;
+    default:
+      owner = m_thumbSearch ? &m_thumbSearch->m_waitingThumbs : &m_searchWaitingThumbs;
+      break;
     }
+    owner->push_back(imageItemPair(thumb, pItem));
+    ThumbWaiter waiter;
+    waiter.item = pItem;
+    waiter.owner = owner;
+    it->second.items.push_back(waiter);
+    startThumbRequests();
+    return true;
   }
-  return false;
 }
 
 bool SpotifyInterface::addAlbumToLibrary()
 {
   CGUIDialogOK *dialog = (CGUIDialogOK *)g_windowManager.GetWindow(WINDOW_DIALOG_OK);
   dialog->SetHeading("Spotify");
-  if (reconnect())
+
+  //take what we need from the album browse, the database is written without the session lock
+  std::vector<CSong> songs;
+  CStdString cachedThumb ="";
   {
-    CMusicDatabase db;
-    CStdString albumname = "";
-    CStdString artistname = "";
-    CStdString cachedThumb ="";
-    if (!m_browseAlbumVector.IsEmpty() && db.Open())
+    CSingleLock lock(getSessionLock());
+    if (reconnect() && m_currentAlbumBrowse)
     {
-      CSong *song;
-      db.BeginTransaction();
-      for (int i=0; i < m_browseAlbumVector.GetFileCount(); i++)
+      CFileItemList &tracks = m_currentAlbumBrowse->m_tracks;
+      for (int i=0; i < tracks.GetFileCount(); i++)
       {
         CFileItemPtr item;
-        item = m_browseAlbumVector.Get(i);
-        MUSIC_INFO::CMusicInfoTag *tag = item->GetMusicInfoTag();
-        song = new CSong(*tag);
-        albumname = song->strAlbum;
-        artistname = song->strAlbumArtist;
-        //the AddSong function seems to crash if you dont provide it with a path before the filename
-        song->strFileName = "/home/" + song->strFileName;
-        cachedThumb = item->GetThumbnailImage();
-        CLog::Log( LOGDEBUG, "Spotifylog: adding track to library: %s", song->strFileName.c_str());
-        db.AddSong(*song, false);
-        delete song;
+        item = tracks.Get(i);
+        songs.push_back(CSong(*item->GetMusicInfoTag()));
+        //where requestThumb put the cover, the thumb itself is set on the gui thread
+        if (!item->GetExtraInfo().IsEmpty())
+          cachedThumb = item->GetExtraInfo();
       }
 
-      //did it create an album?
-      int albumId = db.GetAlbumByName(albumname, artistname);
-      CAlbum album;
-      VECSONGS songs;
-      db.GetAlbumInfo(albumId,album,&songs);
-      album.strType.Format("spotifyalbum");
-      db.SetAlbumInfo(albumId,album,songs,true);
-      if (albumId != -1 && !cachedThumb.IsEmpty())
+      //its "add album to library" item is wrong now, browse it again the next time
+      CURL url(m_currentAlbumBrowse->m_path);
+      m_albumBrowseCache.Remove(url.GetFileNameWithoutPath());
+      m_currentAlbumBrowse.reset();
+    }
+  }
+
+  CMusicDatabase db;
+  if (!songs.empty() && db.Open())
+  {
+    CStdString albumname = "";
+    CStdString artistname = "";
+    db.BeginTransaction();
+    for (unsigned int i=0; i < songs.size(); i++)
+    {
+      CSong &song = songs[i];
+      albumname = song.strAlbum;
+      artistname = song.strAlbumArtist;
+      //the AddSong function seems to crash if you dont provide it with a path before the filename
+      song.strFileName = "/home/" + song.strFileName;
+      CLog::Log( LOGDEBUG, "Spotifylog: adding track to library: %s", song.strFileName.c_str());
+      db.AddSong(song, false);
+    }
+
+    //did it create an album?
+    int albumId = db.GetAlbumByName(albumname, artistname);
+    CAlbum album;
+    VECSONGS albumSongs;
+    db.GetAlbumInfo(albumId,album,&albumSongs);
+    album.strType.Format("spotifyalbum");
+    db.SetAlbumInfo(albumId,album,albumSongs,true);
+    if (albumId != -1 && !cachedThumb.IsEmpty())
+    {
+      //yes it did, so add the thumb to the database
+      CStdString thumb = CUtil::GetCachedAlbumThumb(albumname,artistname);
+      CPicture::CacheThumb(cachedThumb,thumb);
+      db.SaveAlbumThumb(albumId, thumb);
+    }
+    db.CommitTransaction();
+    m_albumIndex.Invalidate();
+
+    //download info for the artist
+   /* CGUIDialogMusicScan* musicScan = (CGUIDialogMusicScan *)g_windowManager.GetWindow(WINDOW_DIALOG_MUSIC_SCAN);
+    if (!musicScan->IsScanning())
+    {
+      CStdString path;
+      int artistId = db.GetArtistByName(artistname);
+      if (artistId != -1 )
       {
-        //yes it did, so add the thumb to the database
-        CStdString thumb = CUtil::GetCachedAlbumThumb(albumname,artistname);
-        CPicture::CacheThumb(cachedThumb,thumb);
-        db.SaveAlbumThumb(albumId, thumb);
+        path.Format("musicdb://2/%ld/",artistId);
+        db.Close();
+        musicScan->StartArtistScan(path);
       }
-      db.CommitTransaction();
+    }*/
+    db.Close();
+    dialog->SetLine(0 ,"");
+    dialog->SetLine(1 ,"Added album to library");
+    dialog->SetLine(2 ,"");
+    dialog->DoModal();
 
-      //download info for the artist
-     /* CGUIDialogMusicScan* musicScan = (CGUIDialogMusicScan *)g_windowManager.GetWindow(WINDOW_DIALOG_MUSIC_SCAN);
-      if (!musicScan->IsScanning())
-      {
-        CStdString path;
-        int artistId = db.GetArtistByName(artistname);
-        if (artistId != -1 )
-        {
-          path.Format("musicdb://2/%ld/",artistId);
-          db.Close();
-          musicScan->StartArtistScan(path);
-        }
-      }*/
-      db.Close();
-      dialog->SetLine(0 ,"");
-      dialog->SetLine(1 ,"Added album to library");
-      dialog->SetLine(2 ,"");
-      dialog->DoModal();
-          
-      CGUIMessage message(GUI_MSG_NOTIFY_ALL, 0, 0, GUI_MSG_UPDATE_PATH);
-      message.SetStringParam("musicdb://");
-      g_windowManager.SendThreadMessage(message);
+    CGUIMessage message(GUI_MSG_NOTIFY_ALL, 0, 0, GUI_MSG_UPDATE_PATH);
+    message.SetStringParam("musicdb://");
+    g_windowManager.SendThreadMessage(message);
 
-      return true;
-    }
+    return true;
   }
   dialog->SetLine(0 ,"");
   dialog->SetLine(1 ,"Failed to add album to library");
@@ -1800,10 +2739,92 @@ bool SpotifyInterface::addAlbumToLibrary()
   return false;
 }
 
+bool SpotifyInterface::importArtist(CStdString strPath)
+{
+  //the artist has been browsed, that is where the command came from
+  CStdString uri = strPath.Mid(39);
+  CUtil::RemoveSlashAtEnd(uri);
+  ArtistBrowsePtr entry = m_artistBrowseCache.Peek(uri);
+  if (!entry || !entry->m_isLoaded || !entry->m_browse)
+    return false;
+
+  sp_artistbrowse *browse = entry->m_browse;
+  SpotifyImport *import = new SpotifyImport(sp_artist_name(sp_artistbrowse_artist(browse)));
+  for (int index = 0; index < sp_artistbrowse_num_albums(browse); index++)
+  {
+    sp_album *spAlbum = sp_artistbrowse_album(browse, index);
+    //only its own albums, not the ones it is on
+    if (sp_album_is_available(spAlbum) && sp_album_artist(spAlbum) == sp_artistbrowse_artist(browse)
+        && !m_albumIndex.Find(sp_album_name(spAlbum), sp_artist_name(sp_album_artist(spAlbum))))
+      import->AddAlbum(spAlbum);
+  }
+  return startImport(import);
+}
+
+bool SpotifyInterface::importPlaylist(int playlist)
+{
+  sp_playlistcontainer *pc = sp_session_playlistcontainer(m_session);
+  sp_playlist *pl = sp_playlistcontainer_playlist(pc, playlist);
+  if (!pl || !sp_playlist_is_loaded(pl))
+    return false;
+
+  SpotifyImport *import = new SpotifyImport(sp_playlist_name(pl));
+  for (int index = 0; index < sp_playlist_num_tracks(pl); index++)
+  {
+    sp_track *spTrack = sp_playlist_track(pl, index);
+    if (!sp_track_is_loaded(spTrack) || !sp_track_is_available(spTrack))
+      continue;
+    sp_album *spAlbum = sp_track_album(spTrack);
+    if (spAlbum && sp_album_is_available(spAlbum) && !m_albumIndex.Find(sp_album_name(spAlbum), sp_artist_name(sp_album_artist(spAlbum))))
+      import->AddAlbum(spAlbum);
+  }
+  return startImport(import);
+}
+
+bool SpotifyInterface::startImport(SpotifyImport *import)
+{
+  CGUIDialogOK *dialog = (CGUIDialogOK *)g_windowManager.GetWindow(WINDOW_DIALOG_OK);
+  dialog->SetHeading("Spotify");
+  dialog->SetLine(0 ,"");
+  dialog->SetLine(2 ,"");
+  if (m_import && !m_import->IsDone())
+  {
+    delete import;
+    dialog->SetLine(1 ,"Already adding albums to the library");
+    CSingleExit ex(getSessionLock());
+    dialog->DoModal();
+    return false;
+  }
+  if (!m_albumIndex.IsReady())
+  {
+    //we can not tell which albums are in the library yet
+    delete import;
+    dialog->SetLine(1 ,"Reading the library, try again in a moment");
+    CSingleExit ex(getSessionLock());
+    dialog->DoModal();
+    return false;
+  }
+  if (import->GetNumAlbums() == 0)
+  {
+    delete import;
+    dialog->SetLine(1 ,"All the albums are in the library already");
+    CSingleExit ex(getSessionLock());
+    dialog->DoModal();
+    return false;
+  }
+
+  delete m_import;
+  m_import = import;
+  m_import->Start(m_session);
+  return true;
+}
+
 CStdString SpotifyInterface::getUsername()
 {
   if (g_advancedSettings.m_spotifyUsername.IsEmpty())
   {
+    //called from getDirectory, dont keep the session thread waiting while the user is typing
+    CSingleExit ex(getSessionLock());
     CGUIDialogKeyboard::ShowAndGetInput(g_advancedSettings.m_spotifyUsername, "Spotify username",false,false);
   }
   return g_advancedSettings.m_spotifyUsername;
@@ -1815,6 +2836,7 @@ CStdString SpotifyInterface::getPassword()
   {
     CStdString message;
     message.Format("Spotify password for user %s", g_advancedSettings.m_spotifyUsername);
+    CSingleExit ex(getSessionLock());
     CGUIDialogKeyboard::ShowAndGetInput(g_advancedSettings.m_spotifyPassword, message,false,true);
   }
   return g_advancedSettings.m_spotifyPassword;
@@ -1822,42 +2844,109 @@ CStdString SpotifyInterface::getPassword()
 
 void SpotifyInterface::showReconectingDialog()
 {
-  m_reconectingDialog = (CGUIDialogProgress*)g_windowManager.GetWindow(WINDOW_DIALOG_PROGRESS);
-  m_reconectingDialog->SetHeading("Spotify");
-  m_reconectingDialog->SetLine(0, "");
-  m_reconectingDialog->SetLine(1 ,"Not connected to Spotify.");
-  m_reconectingDialog->SetLine(2 ,"Reconnecting...");
-  m_reconectingDialog->StartModal();
-  m_reconectingDialog->SetPercentage(50);
-  m_reconectingDialog->Progress();
+  CSingleLock lock(m_guiLock);
   m_isShowingReconnect = true;
+  m_progressChanged = true;
 }
 
 void SpotifyInterface::hideReconectingDialog()
 {
-  if (m_isShowingReconnect)
-  {
-    m_reconectingDialog->Close(true);
-    m_isShowingReconnect = false;
-  }
+  CSingleLock lock(m_guiLock);
+  m_isShowingReconnect = false;
+  m_progressChanged = true;
 }
 
 void SpotifyInterface::showProgressDialog(CStdString message)
 {
-  m_progressDialog = (CGUIDialogProgress*)g_windowManager.GetWindow(WINDOW_DIALOG_PROGRESS);
-  m_progressDialog->SetHeading("Spotify");
-  m_progressDialog->SetLine(0, "");
-  m_progressDialog->SetLine(1, message.c_str());
-  m_progressDialog->SetLine(2, "");
-  m_progressDialog->SetCanCancel(false);
-  m_progressDialog->SetPercentage(0);
-  m_progressDialog->Progress();
-  m_progressDialog->StartModal();
+  CSingleLock lock(m_guiLock);
+  m_progressWanted = true;
+  m_progressMessage = message;
+  m_progressPercentage = 0;
+  m_progressChanged = true;
+}
+
+void SpotifyInterface::setProgress(int percentage)
+{
+  CSingleLock lock(m_guiLock);
+  m_progressPercentage = percentage;
+  m_progressChanged = true;
 }
 
 void SpotifyInterface::hideProgressDialog()
 {
-  m_progressDialog->Close(true);
+  CSingleLock lock(m_guiLock);
+  m_progressWanted = false;
+  m_progressChanged = true;
+}
+
+void SpotifyInterface::postGuiCommand(SpotifyGuiCommand *command)
+{
+  CSingleLock lock(m_guiLock);
+  m_guiCommands.push_back(SpotifyGuiCommandPtr(command));
+}
+
+void SpotifyInterface::processGuiEvents()
+{
+  //a modal dialog of a command runs the gui loop, that calls us again
+  if (m_isProcessingGui)
+    return;
+  m_isProcessingGui = true;
+
+  //did the user cancel the connection process?
+  bool cancelReconnect = false;
+  {
+    CSingleLock lock(m_guiLock);
+    if (m_isShowingReconnect && m_isShowingProgress && m_progressDialog->IsCanceled())
+    {
+      m_isShowingReconnect = false;
+      m_progressChanged = true;
+      cancelReconnect = true;
+    }
+
+    if (m_progressChanged)
+    {
+      m_progressChanged = false;
+      bool wanted = m_isShowingReconnect || m_progressWanted;
+      if (wanted)
+      {
+        m_progressDialog->SetHeading("Spotify");
+        m_progressDialog->SetLine(0, "");
+        if (m_isShowingReconnect)
+        {
+          m_progressDialog->SetLine(1 ,"Not connected to Spotify.");
+          m_progressDialog->SetLine(2 ,"Reconnecting...");
+          m_progressDialog->SetCanCancel(true);
+          m_progressDialog->SetPercentage(50);
+        }else
+        {
+          m_progressDialog->SetLine(1, m_progressMessage.c_str());
+          m_progressDialog->SetLine(2, "");
+          m_progressDialog->SetCanCancel(false);
+          m_progressDialog->SetPercentage(m_progressPercentage);
+        }
+        if (!m_isShowingProgress)
+          m_progressDialog->StartModal();
+      }else if (m_isShowingProgress)
+        m_progressDialog->Close(true);
+      m_isShowingProgress = wanted;
+    }
+  }
+  if (cancelReconnect)
+    postCommand(new SpotifyLogoutCommand());
+
+  while (true)
+  {
+    SpotifyGuiCommandPtr command;
+    {
+      CSingleLock lock(m_guiLock);
+      if (m_guiCommands.empty())
+        break;
+      command = m_guiCommands.front();
+      m_guiCommands.pop_front();
+    }
+    command->Execute();
+  }
+  m_isProcessingGui = false;
 }
 
 void SpotifyInterface::showDisclaimer()
@@ -1882,13 +2971,20 @@ void SpotifyInterface::showConnectionErrorDialog(sp_error error)
   m_yesNoDialog->DoModal();
   if (m_yesNoDialog->IsConfirmed())
   {
-    //if its a problem with username and password, reset them
-    if (SP_ERROR_BAD_USERNAME_OR_PASSWORD == error)
-    {
-      connect(true);
-    }else
+    //if its a problem with username and password, ask for new ones here, the session thread logs in with them
+    CStdString username;
+    CStdString password;
+    bool forceNewUser = SP_ERROR_BAD_USERNAME_OR_PASSWORD == error;
+    if (forceNewUser)
     {
-      connect(false);
+      CGUIDialogKeyboard::ShowAndGetInput(username, "Spotify username",false,false);
+      CStdString message;
+      message.Format("Spotify password for user %s", username.c_str());
+      CGUIDialogKeyboard::ShowAndGetInput(password, message,false,true);
+      //the session thread must not ask for them
+      if (username.IsEmpty() || password.IsEmpty())
+        return;
     }
+    postCommand(new SpotifyConnectCommand(forceNewUser, username, password));
   }
 }
@@ -32,8 +32,11 @@
 #include <spotify/api.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <time.h>
 #include <cstdlib>
 #include <vector>
+#include <map>
+#include <deque>
 #include "StringUtils.h"
 #include "GUIDialogProgress.h"
 #include "GUIDialogOK.h"
@@ -43,9 +46,110 @@
 #include "utils/TimeUtils.h"
 #include "GUIDialog.h"
 #include "FileSystem/MusicDatabaseDirectory/DirectoryNode.h"
+#include "spotifySession.h"
+#include "spotifyLRU.h"
+#include "spotifySnapshot.h"
+#include "spotifyAlbumIndex.h"
+#include "spotifyImport.h"
+#include "spotifyUri.h"
+#include "spotifyThumbCache.h"
+#include "spotifyThumbWriter.h"
+
+//a rough guess of what a CFileItem with its tag costs us, for the cache memory budgets
+#define SPOTIFY_ITEM_COST 2048
+//how long after logging in we wait for the playlists to sync before the snapshot is written with what has loaded
+#define SNAPSHOT_DEADLINE 120000
+//the tracks converted for the snapshot in one turn of the session thread
+#define SNAPSHOT_BATCH 100
+
+//the thumb file of a cover and the item waiting for it
+typedef std::pair<CStdString,CFileItemPtr> imageItemPair;
+
+//the result of browsing one artist, the browse object and its thumbnail requests are released with it
+class SpotifyArtistBrowse
+{
+public:
+  SpotifyArtistBrowse(const CStdString &path) : m_path(path), m_browse(0), m_isLoaded(false) {}
+  ~SpotifyArtistBrowse();
+  size_t GetCost(){ return sizeof(*this) + (m_menu.Size() + m_albums.Size() + m_similarArtists.Size()) * SPOTIFY_ITEM_COST; }
+
+  CStdString m_path;
+  sp_artistbrowse *m_browse;
+  bool m_isLoaded;
+  CFileItemList m_menu;
+  CFileItemList m_albums;
+  CFileItemList m_similarArtists;
+  std::vector<imageItemPair> m_waitingThumbs;
+};
+
+//the tracks of one album, with the browse object they came from
+class SpotifyAlbumBrowse
+{
+public:
+  SpotifyAlbumBrowse(const CStdString &path) : m_path(path), m_browse(0), m_isLoaded(false) {}
+  ~SpotifyAlbumBrowse();
+  size_t GetCost(){ return sizeof(*this) + m_tracks.Size() * SPOTIFY_ITEM_COST; }
+
+  CStdString m_path;
+  sp_albumbrowse *m_browse;
+  bool m_isLoaded;
+  CFileItemList m_tracks;
+};
+
+//the results of one search, kept by query so a repeated search is answered without asking spotify
+class SpotifySearch
+{
+public:
+  SpotifySearch(int id, const CStdString &query) : m_id(id), m_query(query), m_search(0), m_isLoaded(false), m_time(time(NULL)),
+    m_pageSearch(0), m_artistOffset(0), m_albumOffset(0), m_trackOffset(0), m_moreArtists(false), m_moreAlbums(false), m_moreTracks(false) {}
+  ~SpotifySearch();
+  size_t GetCost(){ return sizeof(*this) + (m_artists.Size() + m_albums.Size() + m_tracks.Size()) * SPOTIFY_ITEM_COST; }
+
+  int m_id;
+  CStdString m_query;
+  sp_search *m_search;
+  bool m_isLoaded;
+  time_t m_time;
+  CFileItemList m_artists;
+  CFileItemList m_albums;
+  CFileItemList m_tracks;
+  std::vector<imageItemPair> m_waitingThumbs;
+
+  //the results come a page at a time, the first page is m_search
+  sp_search *m_pageSearch;
+  CStdString m_pageKind;
+  std::vector<sp_search*> m_pages;
+  int m_artistOffset;
+  int m_albumOffset;
+  int m_trackOffset;
+  bool m_moreArtists;
+  bool m_moreAlbums;
+  bool m_moreTracks;
+};
+
+//the tracks of a playlist as handles, the items are only made for the page that is shown
+class SpotifyPlaylistTracks
+{
+public:
+  SpotifyPlaylistTracks(sp_playlist *playlist) : m_playlist(playlist), m_lastPage(0) {}
+  ~SpotifyPlaylistTracks(){ clear(); }
+  //reads the handles from the playlist again
+  void Update();
+  int Size(){ return m_tracks.size(); }
+  sp_track *Get(int index){ return m_tracks[index]; }
+
+  sp_playlist *m_playlist;
+  //the deepest page that has been opened, they all get refreshed when the playlist changes
+  int m_lastPage;
+
+private:
+  void clear();
+  std::vector<sp_track*> m_tracks;
+};
 
 class SpotifyInterface
 {
+  friend class SpotifyImport;
 public:
   SpotifyInterface();
   ~SpotifyInterface();
@@ -64,18 +168,27 @@ public:
   };
 
   //session functions
-  bool connect(bool forceNewUser = false);
+  //a new user logs in with username and password, they are asked for if they are empty
+  bool connect(bool forceNewUser = false, const CStdString &username = "", const CStdString &password = "");
   bool disconnect();
   bool reconnect(bool forceNewUser = false);
-  bool processEvents();
+  //returns the time in ms until libspotify wants to be processed again, only called from the session thread
+  int processEvents();
+  //opens, updates and closes the dialogs, only called from the gui thread
+  void processGuiEvents();
   sp_session * getSession(){return m_session; }
 
+  //libspotify is not thread safe, hold the session lock or post a command to the session thread
+  SpotifyCommandPtr postCommand(SpotifyCommand *command){ return m_sessionThread.Post(command); }
+  CCriticalSection &getSessionLock(){ return m_sessionThread.GetLock(); }
+
   //callback functions definied in api.h
   static void SP_CALLCONV cb_connectionError(sp_session *session, sp_error error);
   static void SP_CALLCONV cb_loggedIn(sp_session *session, sp_error error);
   static void SP_CALLCONV cb_notifyMainThread(sp_session *session);
   static void SP_CALLCONV cb_logMessage(sp_session *session, const char *data);
   static void SP_CALLCONV cb_searchComplete(sp_search *search, void *userdata);
+  static void SP_CALLCONV cb_searchPageComplete(sp_search *search, void *userdata);
   static void SP_CALLCONV cb_albumBrowseComplete(sp_albumbrowse *result, void *userdata);
   static void SP_CALLCONV cb_topListAritstsComplete(sp_toplistbrowse *result, void *userdata);
   static void SP_CALLCONV cb_topListAlbumsComplete(sp_toplistbrowse *result, void *userdata);
@@ -83,8 +196,20 @@ public:
   static void SP_CALLCONV cb_artistBrowseComplete(sp_artistbrowse *result, void *userdata);
   static int SP_CALLCONV cb_musicDelivery(sp_session *session, const sp_audioformat *format, const void *frames, int num_frames);
   static void SP_CALLCONV cb_imageLoaded(sp_image *image, void *userdata);
+  //the playlists change under us, these keep the playlist menu and tracks up to date
+  static void SP_CALLCONV cb_playlistAdded(sp_playlistcontainer *pc, sp_playlist *playlist, int position, void *userdata);
+  static void SP_CALLCONV cb_playlistRemoved(sp_playlistcontainer *pc, sp_playlist *playlist, int position, void *userdata);
+  static void SP_CALLCONV cb_playlistMoved(sp_playlistcontainer *pc, sp_playlist *playlist, int position, int new_position, void *userdata);
+  static void SP_CALLCONV cb_playlistTracksAdded(sp_playlist *pl, sp_track * const *tracks, int num_tracks, int position, void *userdata);
+  static void SP_CALLCONV cb_playlistTracksRemoved(sp_playlist *pl, const int *tracks, int num_tracks, void *userdata);
+  static void SP_CALLCONV cb_playlistTracksMoved(sp_playlist *pl, const int *tracks, int num_tracks, int new_position, void *userdata);
+  static void SP_CALLCONV cb_playlistChanged(sp_playlist *pl, void *userdata);
 
   bool getDirectory(const CStdString &strPath, CFileItemList &items);
+  //the music library has changed
+  void invalidateAlbumIndex(){ m_albumIndex.Invalidate(); }
+  //the item does not want its thumb anymore, the image is released when nobody waits for it
+  void cancelThumb(const imageItemPair &pair);
   XFILE::MUSICDATABASEDIRECTORY::NODE_TYPE getChildType(const CStdString &strPath);
 
 private:
@@ -94,30 +219,40 @@ private:
   sp_error m_error;
   sp_session_callbacks m_callbacks;
   bool m_showDisclaimer;
-  int m_nextEvent;
+  SpotifySessionThread m_sessionThread;
   const char *m_uri;
-  CStdString m_thumbDir;
-  CStdString m_playlistsThumbDir;
-  CStdString m_toplistsThumbDir;
+  //the covers, they stay between sessions
+  SpotifyThumbCache m_thumbCache;
+  SpotifyThumbWriter m_thumbWriter;
   CStdString m_currentPlayingDir;
-  void clean(bool search, bool artistbrowse, bool albumbrowse, bool playlists, bool toplists, bool searchthumbs, bool playliststhumbs, bool toplistthumbs, bool currentplayingthumbs);
+  void clean(bool search, bool artistbrowse, bool albumbrowse, bool playlists, bool toplists, bool currentplayingthumbs);
   void clean();
 
   //functions for searching
   bool search();
   bool search(CStdString searchstring);
-  bool hasSearchResults() { return (!m_searchArtistVector.IsEmpty() || !m_searchAlbumVector.IsEmpty() || !m_searchTrackVector.IsEmpty()); }
+  bool searchMore(CStdString kind);
+  void addSearchResults(SpotifySearch *entry, sp_search *search, bool artists, bool albums, bool tracks);
+  int getSearchPageSize(int offset, int max);
+  bool hasSearchResults() { return m_currentSearch && m_currentSearch->m_isLoaded; }
 
   //menus
   void getMainMenuItems(CFileItemList &items);
   void getSettingsMenuItems(CFileItemList &items);
   void getSearchMenuItems(CFileItemList &items);
+  void getRecentSearchItems(CFileItemList &items);
   void getPlaylistItems(CFileItemList &items);
 
   //browsing album
   bool getBrowseAlbumTracks(CStdString strPath, CFileItemList &items);
   bool addAlbumToLibrary();
 
+  //adding many albums at once, one import runs at a time
+  SpotifyImport *m_import;
+  bool importArtist(CStdString strPath);
+  bool importPlaylist(int playlist);
+  bool startImport(SpotifyImport *import);
+
   //browsing album
   bool browseArtist(CStdString strPath);
   bool getBrowseArtistMenu(CStdString strPath, CFileItemList &items);
@@ -130,43 +265,87 @@ private:
   bool getBrowseToplistArtists(CFileItemList &items);
   bool getBrowseToplistTracks(CFileItemList &items);
 
-  //playlists
-  bool getPlaylistTracks(CFileItemList &items, int playlist);
+  //playlists, big ones are shown a page at a time
+  typedef boost::shared_ptr<SpotifyPlaylistTracks> PlaylistTracksPtr;
+  std::map<int, PlaylistTracksPtr> m_playlistTracks;
+  bool getPlaylistTracks(CFileItemList &items, int playlist, int page = 0);
 
-  //usefull dialogs
-  CGUIDialogProgress *m_reconectingDialog;
+  //the lists from the last time, shown until spotify has logged in and synced
+  SpotifySnapshot m_snapshot;
+  bool m_snapshotPending;
+  unsigned int m_loginTime;
+  unsigned int m_snapshotCheckTime;
+  //the next playlist to write, -1 while we wait for them to sync
+  int m_snapshotPlaylist;
+  //the tracks of that playlist converted so far
+  int m_snapshotTrack;
+  CFileItemList m_snapshotTracks;
+  void updateSnapshot();
+  //a list from the snapshot, its thumbs count as used
+  bool getSnapshot(const CStdString &name, CFileItemList &items);
+  bool isSnapshotLoaded(sp_playlistcontainer *pc, int numPlaylists);
+
+  //the progress dialog, the other threads only say what they want and processGuiEvents shows it
+  //the reconnect message goes before the progress of a search or browse
+  CCriticalSection m_guiLock;
+  std::deque<SpotifyGuiCommandPtr> m_guiCommands;
   CGUIDialogProgress *m_progressDialog;
+  bool m_isShowingProgress;
+  bool m_isProcessingGui;
+  bool m_progressWanted;
+  bool m_progressChanged;
+  CStdString m_progressMessage;
+  int m_progressPercentage;
+  bool m_isShowingReconnect;
 
   //dialog functions
   CStdString getUsername();
   CStdString getPassword();
   void showDisclaimer();
-  bool m_isShowingReconnect;
   void showReconectingDialog();
   void hideReconectingDialog();
   void showProgressDialog(CStdString message);
+  void setProgress(int percentage);
   void hideProgressDialog();
   void showConnectionErrorDialog(sp_error error);
+  void postGuiCommand(SpotifyGuiCommand *command);
+  friend class SpotifyConnectionErrorCommand;
+  friend class SpotifyDidYouMeanCommand;
+  friend class SpotifySearchAgainCommand;
 
-  //search
-  sp_search *m_search;
-  CStdString m_searchStr;
-  bool m_isSearching;
-  CFileItemList m_searchArtistVector;
-  CFileItemList m_searchAlbumVector;
-  CFileItemList m_searchTrackVector;
+  //search, the last searches are kept by query and limits until they get too old
+  typedef SpotifyLRU<CStdString, SpotifySearch> SearchCache;
+  typedef SearchCache::ValuePtr SearchPtr;
+  SearchCache m_searchCache;
+  //the search whose results are shown under menu/search/
+  SearchPtr m_currentSearch;
+  //the search whose items are being converted, their thumbnail requests belong to it
+  SpotifySearch *m_thumbSearch;
+  int m_nextSearchId;
+  CStdString getSearchKey(CStdString query);
+  bool isSearchExpired(SpotifySearch *entry);
+  bool isSearching() { return m_currentSearch && !m_currentSearch->m_isLoaded; }
 
-  //browsing album
-  sp_albumbrowse *m_albumBrowse;
-  CStdString m_albumBrowseStr;
-  CFileItemList m_browseAlbumVector;
+  //the library albums, to show those instead of the spotify ones
+  SpotifyAlbumIndex m_albumIndex;
 
-  //browsing artist
-  sp_artistbrowse *m_artistBrowse;
-  CStdString m_artistBrowseStr;
-  CFileItemList m_browseArtistMenuVector;
-  CFileItemList m_browseArtistAlbumVector;
-  CFileItemList m_browseArtistSimilarArtistsVector;
+  //the uris of everything we have converted to items
+  SpotifyUri m_uris;
+
+  //browsing album, kept by uri like the artists
+  typedef SpotifyLRU<CStdString, SpotifyAlbumBrowse> AlbumBrowseCache;
+  typedef AlbumBrowseCache::ValuePtr AlbumBrowsePtr;
+  AlbumBrowseCache m_albumBrowseCache;
+  //the album that was shown last, it is the one "add album to library" adds
+  AlbumBrowsePtr m_currentAlbumBrowse;
+
+  //browsing artist, the last artists are kept by uri so going back and forth is instant
+  typedef SpotifyLRU<CStdString, SpotifyArtistBrowse> ArtistBrowseCache;
+  typedef ArtistBrowseCache::ValuePtr ArtistBrowsePtr;
+  ArtistBrowseCache m_artistBrowseCache;
+  //the artist whose albums are being converted, their thumbnail requests belong to it
+  SpotifyArtistBrowse *m_thumbArtistBrowse;
+  ArtistBrowsePtr getArtistBrowse(CStdString strPath);
 
   //browsing toplist
   sp_toplistbrowse *m_toplistArtistsBrowse;
@@ -176,21 +355,63 @@ private:
   CFileItemList m_browseToplistAlbumVector;
   CFileItemList m_browseToplistTracksVector;
 
-  //playlists
+  //playlists, the menu items in the order of the container
   CFileItemList m_playlistItems;
+  std::vector<sp_playlist*> m_playlistOrder;
+  sp_playlistcontainer *m_watchedContainer;
+  sp_playlistcontainer_callbacks m_containerCallbacks;
+  sp_playlist_callbacks m_playlistCallbacks;
+  void watchPlaylists();
+  void unwatchPlaylists();
+  void syncPlaylistItems();
+  void playlistTracksChanged(sp_playlist *pl);
+  void updatePlaylistItem(sp_playlist *pl);
+  //without a thumb request the item only gets a cover that is in the cache already
+  //previous is the item the playlist had before, its thumb is kept if the cover is the same
+  CFileItemPtr spPlaylistToItem(sp_playlist *pl, int index, bool withThumbRequest = true, CFileItemPtr previous = CFileItemPtr());
 
   //converting functions
   CFileItemPtr spArtistToItem(sp_artist *spArtist);
   CFileItemPtr spAlbumToItem(sp_album *spAlbum, SPOTIFY_TYPE type);
   CFileItemPtr spTrackToItem(sp_track *spTrack, SPOTIFY_TYPE type, bool loadthumb = false);
+  void spTrackToSong(sp_track *spTrack, CSong &song);
+  //the cover of the album if we have downloaded it before, else an empty string
+  CStdString getAlbumThumb(sp_album *spAlbum);
 
-  //thumbnail handling
-  typedef std::pair<sp_image*,CFileItemPtr> imageItemPair;
+  //thumbnail handling, one request per image id however many items wait for it
+  //only a few are loading at a time, the ones of the latest listing go first and then in list order
+  //an item waiting for a cover and the list that remembers it, so it can be taken out of that list again
+  struct ThumbWaiter
+  {
+    CFileItemPtr item;
+    std::vector<imageItemPair> *owner;
+  };
+  struct ThumbRequest
+  {
+    unsigned char imageId[20];
+    sp_image *image;
+    bool isWriting;
+    unsigned int generation;
+    unsigned int sequence;
+    std::vector<ThumbWaiter> items;
+  };
+  typedef std::map<CStdString, ThumbRequest> ThumbRequestMap;
+  ThumbRequestMap m_thumbRequests;
+  int m_thumbsLoading;
+  unsigned int m_thumbGeneration;
+  unsigned int m_thumbSequence;
+  void startThumbRequests();
+  //the request is done, its items are taken out of the lists that wait for it
+  void finishThumbRequest(ThumbRequestMap::iterator it);
+  //loaded images, they can not be released from their own callback
+  std::vector<sp_image*> m_loadedImages;
+  void releaseLoadedImages();
+  //gives the waiting items the thumbs the writer is done with
+  void thumbsWritten();
   std::vector<imageItemPair> m_searchWaitingThumbs;
-  std::vector<imageItemPair> m_artistWaitingThumbs;
   std::vector<imageItemPair> m_playlistWaitingThumbs;
   std::vector<imageItemPair> m_toplistWaitingThumbs;
-  bool requestThumb(unsigned char *imageId, CStdString Uri, CFileItemPtr pItem, SPOTIFY_TYPE type);
+  bool requestThumb(unsigned char *imageId, CFileItemPtr pItem, SPOTIFY_TYPE type);
 };
 
 extern SpotifyInterface *g_spotifyInterface;